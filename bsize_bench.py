@@ -0,0 +1,55 @@
+import os
+from subprocess import call
+import time
+import re
+from subprocess import Popen, PIPE
+
+# Compare file system throughput across block sizes. For each size the
+# disk image is rebuilt with `make FSBSIZE=<size>`, xk is booted, and the
+# sequential (seqbench), metadata (createbench) and fsbench benchmarks are
+# run.
+block_sizes = [512, 1024, 4096]
+commands = ["seqbench 128\n", "createbench 200\n", "fsbench 200 256\n"]
+output_file = "bench_output.txt"
+ansi_escape = re.compile(r'\x1B(?:[@-Z\\-_]|\[[0-?]*[ -/]*[@-~])')
+
+def run(bsize, w):
+    garbage = open("garbage.txt", 'w')
+    if os.path.exists("out/fs.img"):
+        os.remove("out/fs.img")
+    call(["make", "FSBSIZE=" + str(bsize)], stdout = garbage, stderr = garbage)
+    print("make finished for bsize=" + str(bsize))
+
+    w.write("=== bsize " + str(bsize) + "\n")
+    w.flush()
+    process = Popen([r'make', 'qemu', "FSBSIZE=" + str(bsize)], stdin=PIPE, stdout=w)
+    time.sleep(5)
+    for cmd in commands:
+        process.stdin.write(cmd.encode())
+        process.stdin.flush()
+        time.sleep(10)
+    process.terminate()
+    call(["pkill","qemu"], stdout = garbage, stderr = garbage)
+    garbage.close()
+    os.remove("garbage.txt")
+
+def main():
+    if os.path.exists(output_file):
+        os.remove(output_file)
+
+    w = open(output_file, 'w')
+    for bsize in block_sizes:
+        run(bsize, w)
+    w.close()
+
+    r = open(output_file, 'r')
+    result = ansi_escape.sub('', r.read())
+    r.close()
+
+    # Print one line per benchmark result, grouped by block size
+    for line in result.splitlines():
+        if line.startswith("=== ") or "ticks" in line:
+            print(line.strip())
+
+if __name__ == "__main__":
+    main()
@@ -1,6 +1,7 @@
 import os
+import sys
 from subprocess import call
-from multiprocessing import Process
+from multiprocessing import Process, Pool
 import time
 import re
 from subprocess import Popen, PIPE
@@ -8,8 +9,29 @@ from subprocess import Popen, PIPE
 max_times = 30
 test = "lab4test_c"
 output_file = "output.txt"
+fsck = "out/fsck"
+image = "out/fs.img"
 ansi_escape = re.compile(r'\x1B(?:[@-Z\\-_]|\[[0-?]*[ -/]*[@-~])')
 
+# Run the host fsck on an image. Returns (image, consistent, summary line).
+def check_image(path):
+    process = Popen([fsck, path], stdout=PIPE, stderr=PIPE)
+    out, err = process.communicate()
+    lines = (out + err).decode().strip().splitlines()
+    return (path, process.returncode == 0, lines[-1] if lines else "")
+
+# Check images saved at crash points, in parallel.
+def check_images(paths):
+    call(["make", fsck])
+    bad = 0
+    with Pool() as pool:
+        for path, ok, summary in pool.imap(check_image, paths):
+            if not ok:
+                bad += 1
+                print(path + ": " + summary)
+    print(str(len(paths) - bad) + " of " + str(len(paths)) + " images consistent")
+    return bad == 0
+
 def main():
     garbage = open("garbage.txt", 'w')
     call(["make","clean"], stdout = garbage, stderr = garbage)
@@ -19,6 +41,7 @@ def main():
     print("clean finished.")
 
     call(["make"], stdout = garbage, stderr = garbage)
+    call(["make", fsck], stdout = garbage, stderr = garbage)
     print("make finished.")
 
     w = open(output_file, 'w')
@@ -55,5 +78,14 @@ def main():
 
     r.close()
 
+    # Check the image the crashes left behind
+    path, ok, summary = check_image(image)
+    print("fsck " + path + ": " + summary)
+    if not ok:
+        print("file system image is not consistent")
+
 if __name__ == "__main__":
+    # crash_safety_test.py --fsck IMAGE... checks saved images offline
+    if len(sys.argv) > 1 and sys.argv[1] == "--fsck":
+        sys.exit(0 if check_images(sys.argv[2:]) else 1)
     main()
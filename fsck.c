@@ -0,0 +1,736 @@
+// Check an xk file system image on the host, and report how fragmented its
+// files and free space are.
+//
+// usage: fsck [-j nthreads] [-v] fs.img
+//
+// The checks:
+// * the super block describes a layout that fits in the image
+// * the log header is well formed. A committed transaction is replayed in
+//   memory, as the kernel would at boot, before anything else is checked.
+// * every dinode has a valid type and flags, and its extents or extent
+//   tree map blocks in the data area, in file block order
+// * no block is used twice, except for data blocks of DI_SHARED files,
+//   whose counts in the reference count file must match
+// * the bitmap marks exactly the metadata and the blocks in use
+// * directory entries name allocated inodes, and every file is in a
+//   directory
+//
+// The image is mapped read-only and never changed. The inodes and the
+// bitmap are checked by -j threads (one per CPU by default).
+//
+// Exits with status 1 if the image has errors. Blocks marked in use that
+// no file uses, which a crash can leave behind, are only warnings.
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+typedef unsigned long  ulong;
+typedef unsigned int   uint;
+typedef unsigned short ushort;
+typedef unsigned char  uchar;
+
+#define stat xk_stat  // avoid clash with host struct stat
+#include <inc/fs.h>
+#include <inc/stat.h>
+#include <inc/param.h>
+
+#define NLOGBLK 79 // entries in the log header (see kernel/lio.c)
+#define MAXREPORT 20 // errors and warnings printed of each kind, without -v
+#define NHIST 16 // histogram buckets, by powers of 2
+
+// Entries in the root of an extent tree (in the dinode) and in a node block
+#define NROOTENT \
+  ((30 * sizeof(struct extent) - sizeof(struct extent_header)) / \
+   sizeof(struct extent_entry))
+#define NBLKENT \
+  ((bsize - sizeof(struct extent_header)) / sizeof(struct extent_entry))
+
+// How a block is used, in claimed[]
+#define CL_NODE 0x1   // extent tree node
+#define CL_DATA 0x2   // data of a file whose blocks are not shared
+#define CL_SHARED 0x4 // data of a DI_SHARED file
+
+uint bsize;
+uchar *img;
+ulong imgsize;
+struct superblock sb;
+uint *overlay;   // block -> log block holding its committed contents, or 0
+uint ninodes;
+short *itype;    // type of each inode, 0 if free
+ushort *nclaim;  // times each block is used
+uchar *claimed;  // CL_* bits for each block
+ushort *nlinks;  // directory entries naming each inode
+ushort *refcnt;  // the reference count file, one count per block
+int nthreads;
+int verbose;
+
+pthread_mutex_t outlock = PTHREAD_MUTEX_INITIALIZER;
+int nerrors;
+int nwarnings;
+uint nextwork;   // next unit of work for the threads
+
+// Counts gathered by the threads
+struct stats {
+  uint nfile, ndir, ndev, ninline, ntree, nshared;
+  uint datablocks, nodeblocks, extents;
+  uint exthist[NHIST]; // files by number of extents
+} stats;
+
+void
+report(int *count, char *kind, char *fmt, va_list ap)
+{
+  pthread_mutex_lock(&outlock);
+  if(verbose || *count < MAXREPORT){
+    printf("%s: ", kind);
+    vprintf(fmt, ap);
+    printf("\n");
+  } else if(*count == MAXREPORT){
+    printf("%s: more %ss not shown (use -v)\n", kind, kind);
+  }
+  (*count)++;
+  pthread_mutex_unlock(&outlock);
+}
+
+void
+error(char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  report(&nerrors, "error", fmt, ap);
+  va_end(ap);
+}
+
+void
+warning(char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  report(&nwarnings, "warning", fmt, ap);
+  va_end(ap);
+}
+
+// Bucket of a histogram by powers of 2: 0, 1, 2-3, 4-7, ...
+int
+bucket(uint n)
+{
+  int i;
+
+  for(i = 0; n > 0 && i < NHIST - 1; i++)
+    n >>= 1;
+  return i;
+}
+
+// Contents of block b as the kernel would see them after replaying the log.
+uchar*
+blk(uint b)
+{
+  if(overlay[b])
+    b = overlay[b];
+  return img + (ulong)b * bsize;
+}
+
+// Whether the bitmap marks block b used.
+int
+bused(uint b)
+{
+  return (blk(BBLOCK(b, sb))[(b % BPB(sb)) / 8] >> (b % 8)) & 1;
+}
+
+// Whether [b, b + n) lies in the data area.
+int
+datarange(uint b, uint n)
+{
+  return b >= sb.inodestart && b < sb.size && n <= sb.size - b;
+}
+
+void
+claim(uint b, uint n, int how)
+{
+  uint i;
+
+  for(i = b; i < b + n; i++){
+    __atomic_fetch_add(&nclaim[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&claimed[i], how, __ATOMIC_RELAXED);
+  }
+}
+
+// The disk block holding file block fbn of dip, or 0 if there is none.
+// Only follows maps that checkinode found to be well formed.
+uint
+bmap(struct dinode *dip, uint fbn)
+{
+  struct extent_header *h;
+  struct extent_entry *e;
+  uint f;
+  int i, j;
+
+  if(!(dip->flags & DI_ETREE)){
+    for(f = 0, i = 0; i < 30 && dip->data[i].nblocks != 0; i++){
+      if(fbn < f + dip->data[i].nblocks)
+        return dip->data[i].startblkno + (fbn - f);
+      f += dip->data[i].nblocks;
+    }
+    return 0;
+  }
+
+  h = (struct extent_header*)dip->data;
+  for(;;){
+    e = (struct extent_entry*)(h + 1);
+    for(j = -1, i = 0; i < h->nentries && e[i].fbn <= fbn; i++)
+      j = i;
+    if(j < 0)
+      return 0;
+    if(h->depth == 0)
+      return fbn - e[j].fbn < e[j].nblocks ? e[j].startblkno + (fbn - e[j].fbn) : 0;
+    h = (struct extent_header*)blk(e[j].startblkno);
+  }
+}
+
+// Copy n bytes at off of the file of dip to dst. Holes read as zeros.
+void
+readfile(struct dinode *dip, uint off, uint n, void *dst)
+{
+  uchar *p = dst;
+  uint b, m;
+
+  if(dip->flags & DI_INLINE){
+    memmove(dst, (uchar*)dip->data + off, n);
+    return;
+  }
+  for(; n > 0; off += m, p += m, n -= m){
+    m = bsize - off % bsize;
+    if(m > n)
+      m = n;
+    if((b = bmap(dip, off / bsize)) == 0)
+      memset(p, 0, m);
+    else
+      memmove(p, blk(b) + off % bsize, m);
+  }
+}
+
+// Read dinode inum from the inodefile.
+void
+rinode(uint inum, struct dinode *dip)
+{
+  struct dinode *inodefile = (struct dinode*)blk(sb.inodestart);
+
+  if(inum == INODEFILEINO)
+    *dip = *inodefile;
+  else
+    readfile(inodefile, INODEOFF(inum), sizeof(*dip), dip);
+}
+
+// State of the walk over one file's extents
+struct walk {
+  uint inum;
+  int how;       // CL_DATA or CL_SHARED
+  uint fbnend;   // file block just past the last extent seen
+  uint extents;
+  uint blocks;
+  uint nodes;
+};
+
+// Check one extent of a file and claim its blocks.
+int
+checkextent(struct walk *w, uint fbn, uint b, uint n)
+{
+  if(n == 0 || fbn + n < fbn){
+    error("inode %u: extent at file block %u has bad length %u", w->inum, fbn, n);
+    return -1;
+  }
+  if(fbn < w->fbnend){
+    error("inode %u: extent at file block %u overlaps or is out of order", w->inum, fbn);
+    return -1;
+  }
+  if(!datarange(b, n)){
+    error("inode %u: extent of blocks %u-%u is outside the data area",
+        w->inum, b, b + n - 1);
+    return -1;
+  }
+  claim(b, n, w->how);
+  w->fbnend = fbn + n;
+  w->extents++;
+  w->blocks += n;
+  return 0;
+}
+
+// Check the extent tree node h, which may hold max entries and covers the
+// file blocks in [lo, hi).
+int
+checknode(struct walk *w, struct extent_header *h, uint max, uint lo, uint hi)
+{
+  struct extent_entry *e = (struct extent_entry*)(h + 1);
+  struct extent_header *ch;
+  uint end;
+  int i;
+
+  if(h->nentries > max){
+    error("inode %u: extent tree node has %u entries, at most %u fit",
+        w->inum, h->nentries, max);
+    return -1;
+  }
+  for(i = 0; i < h->nentries; i++){
+    if(i > 0 && e[i].fbn <= e[i - 1].fbn){
+      error("inode %u: extent tree entries out of order", w->inum);
+      return -1;
+    }
+    end = i + 1 < h->nentries ? e[i + 1].fbn : hi;
+    if(h->depth == 0){
+      if(e[i].fbn < lo || e[i].fbn + e[i].nblocks > end){
+        error("inode %u: extent at file block %u is outside its node's range",
+            w->inum, e[i].fbn);
+        return -1;
+      }
+      if(checkextent(w, e[i].fbn, e[i].startblkno, e[i].nblocks) < 0)
+        return -1;
+      continue;
+    }
+
+    if(!datarange(e[i].startblkno, 1)){
+      error("inode %u: extent tree node block %u is outside the data area",
+          w->inum, e[i].startblkno);
+      return -1;
+    }
+    claim(e[i].startblkno, 1, CL_NODE);
+    w->nodes++;
+    ch = (struct extent_header*)blk(e[i].startblkno);
+    if(ch->depth != h->depth - 1){
+      error("inode %u: extent tree node %u has depth %u, expected %u",
+          w->inum, e[i].startblkno, ch->depth, h->depth - 1);
+      return -1;
+    }
+    if(checknode(w, ch, NBLKENT, i == 0 ? lo : e[i].fbn, end) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Check the map of dinode inum. Returns -1 if it is malformed.
+int
+checkmap(uint inum, struct dinode *dip)
+{
+  struct extent_header *h;
+  struct walk w;
+  int i, r;
+
+  memset(&w, 0, sizeof(w));
+  w.inum = inum;
+  w.how = (dip->flags & DI_SHARED) ? CL_SHARED : CL_DATA;
+
+  r = 0;
+  if(dip->flags & DI_ETREE){
+    h = (struct extent_header*)dip->data;
+    if(h->depth > 8){
+      error("inode %u: extent tree is too deep", inum);
+      return -1;
+    }
+    r = checknode(&w, h, NROOTENT, 0, ~0U);
+  } else {
+    for(i = 0; i < 30 && dip->data[i].nblocks != 0; i++){
+      if((r = checkextent(&w, w.fbnend, dip->data[i].startblkno,
+                          dip->data[i].nblocks)) < 0)
+        break;
+    }
+  }
+
+  __atomic_fetch_add(&stats.extents, w.extents, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats.datablocks, w.blocks, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats.nodeblocks, w.nodes, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats.exthist[bucket(w.extents)], 1, __ATOMIC_RELAXED);
+  return r;
+}
+
+// Check the entries of directory inum.
+void
+checkdir(uint inum, struct dinode *dip)
+{
+  struct dirent de;
+  uint off;
+  int dot, dotdot;
+
+  if(dip->size % sizeof(de) != 0)
+    error("directory %u: size %u is not a multiple of the entry size",
+        inum, dip->size);
+
+  dot = dotdot = 0;
+  for(off = 0; off + sizeof(de) <= dip->size; off += sizeof(de)){
+    readfile(dip, off, sizeof(de), &de);
+    if(de.inum == 0)
+      continue;
+    if(de.inum >= ninodes || itype[de.inum] == 0){
+      error("directory %u: entry '%.*s' names free inode %u",
+          inum, DIRSIZ, de.name, de.inum);
+      continue;
+    }
+    if(strncmp(de.name, ".", DIRSIZ) == 0){
+      dot = 1;
+      if(de.inum != inum)
+        error("directory %u: '.' names inode %u", inum, de.inum);
+    } else if(strncmp(de.name, "..", DIRSIZ) == 0){
+      dotdot = 1;
+      if(itype[de.inum] != T_DIR)
+        error("directory %u: '..' names inode %u, not a directory",
+            inum, de.inum);
+    } else {
+      __atomic_fetch_add(&nlinks[de.inum], 1, __ATOMIC_RELAXED);
+    }
+  }
+  if(!dot || !dotdot)
+    error("directory %u: missing '.' or '..'", inum);
+}
+
+void
+checkinode(uint inum)
+{
+  struct dinode di;
+  ushort bad;
+
+  // unlink frees an inode by setting its type to -1
+  rinode(inum, &di);
+  if(di.type <= 0)
+    return;
+
+  if(di.type == T_FILE)
+    __atomic_fetch_add(&stats.nfile, 1, __ATOMIC_RELAXED);
+  else if(di.type == T_DIR)
+    __atomic_fetch_add(&stats.ndir, 1, __ATOMIC_RELAXED);
+  else if(di.type == T_DEV)
+    __atomic_fetch_add(&stats.ndev, 1, __ATOMIC_RELAXED);
+  else {
+    error("inode %u: bad type %d", inum, di.type);
+    return;
+  }
+
+  bad = di.flags & ~(DI_INLINE | DI_ETREE | DI_SHARED);
+  if(bad || ((di.flags & DI_INLINE) && (di.flags & (DI_ETREE | DI_SHARED)))){
+    error("inode %u: bad flags 0x%x", inum, di.flags);
+    return;
+  }
+  if(di.flags & DI_SHARED)
+    __atomic_fetch_add(&stats.nshared, 1, __ATOMIC_RELAXED);
+  if(di.flags & DI_ETREE)
+    __atomic_fetch_add(&stats.ntree, 1, __ATOMIC_RELAXED);
+
+  if(di.flags & DI_INLINE){
+    __atomic_fetch_add(&stats.ninline, 1, __ATOMIC_RELAXED);
+    if(di.size > INLINESIZE){
+      error("inode %u: inline file of size %u", inum, di.size);
+      return;
+    }
+  } else if(di.type != T_DEV && checkmap(inum, &di) < 0){
+    return;
+  }
+
+  if(di.type == T_DIR)
+    checkdir(inum, &di);
+}
+
+// Take the next unit of work of n units, or return -1 when there is none.
+long
+nextunit(uint n)
+{
+  uint u = __atomic_fetch_add(&nextwork, 1, __ATOMIC_RELAXED);
+
+  return u < n ? (long)u : -1;
+}
+
+#define INODECHUNK 64
+
+void*
+inodeworker(void *arg)
+{
+  long u;
+  uint inum;
+
+  while((u = nextunit((ninodes + INODECHUNK - 1) / INODECHUNK)) >= 0)
+    for(inum = u * INODECHUNK; inum < ninodes && inum < (u + 1) * INODECHUNK; inum++)
+      checkinode(inum);
+  return 0;
+}
+
+// Compare the blocks covered by each bitmap block with their use.
+void*
+bitmapworker(void *arg)
+{
+  long u;
+  uint b, rc;
+  int used, want;
+
+  while((u = nextunit((sb.size + BPB(sb) - 1) / BPB(sb))) >= 0){
+    for(b = u * BPB(sb); b < sb.size && b < (u + 1) * BPB(sb); b++){
+      rc = refcnt[b];
+      if(nclaim[b] > 1 && (claimed[b] != CL_SHARED || rc != nclaim[b] - 1))
+        error("block %u is used %u times (reference count %u)",
+            b, nclaim[b], rc);
+      else if(nclaim[b] <= 1 && rc != 0)
+        error("block %u is used %u times but has reference count %u",
+            b, nclaim[b], rc);
+
+      used = bused(b);
+      want = b < sb.inodestart || nclaim[b] > 0;
+      if(want && !used)
+        error("block %u is in use but marked free", b);
+      else if(used && !want)
+        warning("block %u is marked in use but unused", b);
+    }
+  }
+  return 0;
+}
+
+void
+runthreads(void *(*fn)(void*))
+{
+  pthread_t t[64];
+  int i;
+
+  nextwork = 0;
+  for(i = 0; i < nthreads; i++)
+    if(pthread_create(&t[i], 0, fn, 0) != 0){
+      perror("pthread_create");
+      exit(2);
+    }
+  for(i = 0; i < nthreads; i++)
+    pthread_join(t[i], 0);
+}
+
+// Check the log header, and note the blocks of a committed transaction
+// so they are read from the log.
+void
+checklog(void)
+{
+  logheader lh;
+  int i, n;
+
+  memmove(&lh, img + (ulong)sb.logstart * bsize, sizeof(lh));
+  if(lh.commit != 0 && lh.commit != 1){
+    error("log: bad commit flag %d", lh.commit);
+    return;
+  }
+  for(n = 0; n < NLOGBLK && lh.data[n] != 0; n++){
+    if(lh.data[n] >= sb.size || lh.data[n] < sb.bmapstart){
+      error("log: entry %d is for block %u, outside the file system", n, lh.data[n]);
+      return;
+    }
+  }
+  for(i = n; i < NLOGBLK; i++){
+    if(lh.data[i] != 0){
+      error("log: entry %d follows the end of the log", i);
+      return;
+    }
+  }
+
+  if(n == 0){
+    printf("log: empty\n");
+  } else if(lh.commit){
+    printf("log: committed transaction of %d blocks, replayed\n", n);
+    for(i = 0; i < n; i++)
+      overlay[lh.data[i]] = sb.logstart + 1 + i;
+  } else {
+    printf("log: unfinished transaction of %d blocks, ignored\n", n);
+  }
+}
+
+int
+checksb(void)
+{
+  uint nbitmap;
+
+  memmove(&sb, img + SBOFF, sizeof(sb));
+  bsize = sb.bsize ? sb.bsize : MINBSIZE;
+  sb.bsize = bsize;
+  if(bsize < MINBSIZE || bsize > MAXBSIZE || (bsize & (bsize - 1)) != 0){
+    error("super block: bad block size %u", bsize);
+    return -1;
+  }
+  if((ulong)sb.size * bsize > imgsize){
+    error("super block: %u blocks do not fit in a %lu byte image",
+        sb.size, imgsize);
+    return -1;
+  }
+  nbitmap = sb.logstart - sb.bmapstart;
+  if(sb.bmapstart < 2 || sb.logstart <= sb.bmapstart ||
+     (ulong)nbitmap * BPB(sb) < sb.size ||
+     sb.inodestart < sb.logstart + 1 + NLOGBLK || sb.inodestart >= sb.size){
+    error("super block: bad layout (bitmap %u, log %u, inodes %u, size %u)",
+        sb.bmapstart, sb.logstart, sb.inodestart, sb.size);
+    return -1;
+  }
+  printf("super block: %u blocks of %u bytes, bitmap %u, log %u, inodes %u\n",
+      sb.size, bsize, sb.bmapstart, sb.logstart, sb.inodestart);
+  return 0;
+}
+
+void
+printhist(char *title, uint *hist, uint *blocks)
+{
+  int i;
+
+  printf("%s\n", title);
+  for(i = 0; i < NHIST; i++){
+    if(hist[i] == 0)
+      continue;
+    if(i <= 1)
+      printf("  %10u: %8u", i, hist[i]);
+    else if(i == NHIST - 1)
+      printf("  %9u+: %8u", 1U << (i - 1), hist[i]);
+    else
+      printf("  %4u-%5u: %8u", 1U << (i - 1), (1U << i) - 1, hist[i]);
+    if(blocks)
+      printf(" (%u blocks)", blocks[i]);
+    printf("\n");
+  }
+}
+
+// Print the histogram of free runs, and the file fragmentation.
+void
+printstats(void)
+{
+  uint hist[NHIST], blocks[NHIST];
+  uint b, run, nfree, largest, nfiles;
+
+  memset(hist, 0, sizeof(hist));
+  memset(blocks, 0, sizeof(blocks));
+  nfree = largest = run = 0;
+  for(b = sb.inodestart; b <= sb.size; b++){
+    if(b < sb.size && !bused(b)){
+      run++;
+      continue;
+    }
+    if(run > 0){
+      hist[bucket(run)]++;
+      blocks[bucket(run)] += run;
+      nfree += run;
+      if(run > largest)
+        largest = run;
+      run = 0;
+    }
+  }
+
+  printf("inodes: %u of %u in use: %u files (%u inline, %u extent trees, "
+      "%u shared), %u directories, %u devices\n",
+      stats.nfile + stats.ndir + stats.ndev, ninodes, stats.nfile,
+      stats.ninline, stats.ntree, stats.nshared, stats.ndir, stats.ndev);
+  printf("blocks: %u data, %u extent tree nodes, %u free, largest free run %u\n",
+      stats.datablocks, stats.nodeblocks, nfree, largest);
+  nfiles = stats.nfile + stats.ndir - stats.ninline;
+  if(nfiles > 0)
+    printf("fragmentation: %u extents in %u files, %.2f per file, "
+        "%u files in more than one\n", stats.extents, nfiles,
+        (double)stats.extents / nfiles,
+        nfiles - stats.exthist[0] - stats.exthist[1]);
+  printhist("files by number of extents:", stats.exthist, 0);
+  printhist("free runs by length in blocks:", hist, blocks);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct dinode di;
+  uint inum, b;
+  int fd, c;
+
+  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  while((c = getopt(argc, argv, "j:v")) != -1){
+    if(c == 'j')
+      nthreads = atoi(optarg);
+    else if(c == 'v')
+      verbose = 1;
+    else
+      break;
+  }
+  if(optind != argc - 1 || c == '?'){
+    fprintf(stderr, "Usage: fsck [-j nthreads] [-v] fs.img\n");
+    exit(2);
+  }
+  if(nthreads < 1)
+    nthreads = 1;
+  if(nthreads > 64)
+    nthreads = 64;
+
+  if((fd = open(argv[optind], O_RDONLY)) < 0){
+    perror(argv[optind]);
+    exit(2);
+  }
+  imgsize = lseek(fd, 0, SEEK_END);
+  if(imgsize < SBOFF + sizeof(sb)){
+    fprintf(stderr, "fsck: %s is too small\n", argv[optind]);
+    exit(2);
+  }
+  img = mmap(0, imgsize, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(img == MAP_FAILED){
+    perror("mmap");
+    exit(2);
+  }
+
+  if(checksb() < 0)
+    exit(1);
+  overlay = calloc(sb.size, sizeof(uint));
+  nclaim = calloc(sb.size, sizeof(ushort));
+  claimed = calloc(sb.size, sizeof(uchar));
+  refcnt = calloc(sb.size, sizeof(ushort));
+  assert(overlay && nclaim && claimed && refcnt);
+  checklog();
+
+  // The inodefile maps itself, so check its map before reading through it
+  rinode(INODEFILEINO, &di);
+  if(di.type != T_FILE || (di.flags & (DI_INLINE | DI_SHARED)) ||
+     checkmap(INODEFILEINO, &di) < 0){
+    error("inodefile is unreadable");
+    exit(1);
+  }
+  ninodes = di.size / sizeof(struct dinode);
+  itype = calloc(ninodes, sizeof(short));
+  nlinks = calloc(ninodes, sizeof(ushort));
+  assert(itype && nlinks);
+  for(inum = 0; inum < ninodes; inum++){
+    rinode(inum, &di);
+    itype[inum] = di.type > 0 ? di.type : 0;
+  }
+  if(ninodes <= ROOTINO || itype[ROOTINO] != T_DIR){
+    error("no root directory");
+    exit(1);
+  }
+
+  // Read the reference counts, if the image has a reference count file
+  if(ninodes > REFCNTINO && itype[REFCNTINO] == T_FILE){
+    rinode(REFCNTINO, &di);
+    if((di.flags & DI_INLINE) ? di.size <= INLINESIZE
+                              : checkmap(REFCNTINO, &di) == 0)
+      readfile(&di, 0, di.size < sb.size * sizeof(ushort) ?
+               di.size : sb.size * sizeof(ushort), refcnt);
+  }
+
+  // The inodefile and the reference count file were counted already
+  memset(&stats, 0, sizeof(stats));
+  memset(nclaim, 0, sb.size * sizeof(ushort));
+  memset(claimed, 0, sb.size);
+  runthreads(inodeworker);
+
+  for(inum = 0; inum < ninodes; inum++){
+    if(itype[inum] == 0 || inum == INODEFILEINO || inum == ROOTINO ||
+       inum == REFCNTINO)
+      continue;
+    if(nlinks[inum] == 0)
+      warning("inode %u (type %d) is in no directory", inum, itype[inum]);
+    else if(itype[inum] == T_DIR && nlinks[inum] > 1)
+      error("directory %u is in %u directories", inum, nlinks[inum]);
+  }
+
+  for(b = 0; b < sb.inodestart; b++)
+    if(nclaim[b] > 0)
+      error("metadata block %u is used by a file", b);
+  runthreads(bitmapworker);
+
+  printstats();
+  printf("fsck: %d errors, %d warnings\n", nerrors, nwarnings);
+  exit(nerrors > 0);
+}
@@ -4,7 +4,10 @@
 struct buf;
 struct context;
 struct extent;
+struct fiemap;
+struct fiemap_extent;
 struct inode;
+struct iovec;
 struct proc;
 struct rtcdate;
 struct spinlock;
@@ -47,7 +50,11 @@ void binit(void);
 struct buf *bread(uint, uint);
 void brelse(struct buf *);
 void bwrite(struct buf *);
+void bsetsize(uint);
+void breaddirect(uint, uint, uchar *);
+void bwritedirect(uint, uint, uchar *);
 void print_data_at_block(uint);
+extern uint bsize;
 
 // console.c
 void consoleinit(void);
@@ -55,12 +62,22 @@ void cprintf(char *, ...);
 void consoleintr(int (*)(void));
 noreturn void panic(char *);
 
+// dcache.c
+void dcacheinit(void);
+int dcachelookup(uint, uint, char *, uint *);
+void dcacheinsert(uint, uint, char *, uint);
+void dcacheinvalidate(uint, uint, char *);
+void dcachepurge(uint, uint);
+
 // exec.c
 int exec(char *, char **);
 
 // fs.c
 void readsb(int dev, struct superblock *sb);
 struct inode *dirlookup(struct inode *, char *, uint *);
+int dirlink(struct inode *, char *, uint);
+int dirunlink(struct inode *, char *, uint);
+uint emap(struct inode *, uint);
 struct inode *rootlookup(char *);
 struct inode *idup(struct inode *);
 void iinit(int dev);
@@ -72,12 +89,24 @@ struct inode *namei(char *);
 struct inode *nameiparent(char *, char *);
 struct inode *iopen(char *, int);
 int concurrent_readi(struct inode *, char *, uint, uint);
+int concurrent_readi_direct(struct inode *, char *, uint, uint);
 int readi(struct inode *, char *, uint, uint);
 void concurrent_stati(struct inode *, struct stat *);
 void stati(struct inode *, struct stat *);
 int concurrent_writei(struct inode *, char *, uint, uint);
+int concurrent_readvi(struct inode *, struct iovec *, int, uint, bool);
+int concurrent_writevi(struct inode *, struct iovec *, int, uint);
+int concurrent_truncatei(struct inode *, uint);
+int concurrent_allocatei(struct inode *, uint, uint, bool);
+int concurrent_clonei(struct inode *, struct inode *);
+int concurrent_defragi(struct inode *, uint *, uint *);
+int concurrent_fiemapi(struct inode *, struct fiemap *,
+                       struct fiemap_extent *, uint);
 int writei(struct inode *, char *, uint, uint);
+char *imappage(struct inode *, uint);
 int unlink(char*);
+int mkdir(char *);
+int chdir(char *);
 
 // lio.c
 void logbegin();
@@ -142,11 +171,24 @@ int                 vspacecopy(struct vspace *, struct vspace *);
 int                 vspacecowcopy(struct proc *, struct proc *);
 int                 vspaceinitstack(struct vspace *, uint64_t);
 int                 vspacewritetova(struct vspace *, uint64_t, char *, int);
+char*               uva2ka(struct vspace *, uint64_t, int);
+int                 vspacefault(struct vspace *, uint64_t, bool);
+uint64_t            vspacemmap(struct vspace *, struct inode *, uint, uint64_t, bool, bool);
+int                 vspacemunmap(struct vspace *, uint64_t, uint64_t);
+void                vspacesync(struct vspace *);
 void                vspacedumpstack(struct vspace *);
 void                vspacedumpcode(struct vspace *);
 int                 vregionaddmap(struct vregion *, uint64_t, uint64_t, short, short);
 int                 vregiondelmap(struct vregion *, uint64_t, uint64_t);
 
+// pcache.c
+void pcacheinit(void);
+struct pcpage *pcget(struct inode *, uint);
+void pcwrite(struct inode *, struct pcpage *, uint, uint);
+void pcput(struct pcpage *);
+char *pcmap(struct pcpage *);
+void pcdrop(struct inode *);
+
 // picirq.c
 void picenable(int);
 void picinit(void);
@@ -320,11 +362,268 @@ int sys_write(void);
  */
 int sys_fstat(void);
 
+/*
+ * arg0: int [file descriptor]
+ * arg1: int [offset]
+ * arg2: int [SEEK_SET, SEEK_CUR or SEEK_END (see inc/fcntl.h)]
+ *
+ * Move the current position of the file to arg1 bytes from the start of the
+ * file, the current position or the end of the file. The position may pass
+ * the end of the file; a write there leaves a hole, which reads as zeros.
+ *
+ * Returns the new position, or -1 on error.
+ *
+ * Error conditions:
+ * arg0 is not an open file descriptor, or is a pipe
+ * arg2 is not a valid whence
+ * the new position is negative
+ */
+int sys_lseek(void);
+
+/*
+ * arg0: int [file descriptor]
+ * arg1: char * [buffer]
+ * arg2: int [number of bytes]
+ * arg3: int [file offset]
+ *
+ * Like read and write, but at file offset arg3 instead of the current
+ * position, which is neither used nor changed. Calls on the same
+ * descriptor don't wait for each other's offset updates.
+ *
+ * pread returns 0 at or past the end of the file. pwrite may extend the
+ * file, leaving a hole if it starts past the end.
+ *
+ * Returns the number of bytes read or written, or -1 on error.
+ *
+ * Error conditions:
+ * arg0 is not a file descriptor open for reading (pread) or writing (pwrite),
+ * or is a pipe
+ * some address between [arg1, arg1+arg2) is invalid
+ * arg2 or arg3 is negative
+ */
+int sys_pread(void);
+int sys_pwrite(void);
+
+/*
+ * arg0: int [file descriptor]
+ * arg1: struct iovec * [array of buffers (see inc/uio.h)]
+ * arg2: int [number of buffers, at most IOV_MAX]
+ *
+ * Like read and write, but fill or drain each buffer of arg1 in turn, as
+ * one call on the file. A short read stops at the buffer it ended in.
+ *
+ * Returns the total number of bytes read or written, or -1 on error.
+ *
+ * Error conditions:
+ * arg0 is not a file descriptor open for reading (readv) or writing (writev)
+ * arg2 is negative or more than IOV_MAX
+ * some address in arg1 or in one of its buffers is invalid
+ * a buffer length is negative, or the lengths add up past INT_MAX
+ */
+int sys_readv(void);
+int sys_writev(void);
+
+/*
+ * arg0: int [file descriptor]
+ * arg1: int [new size of the file]
+ *
+ * Set the size of a regular file. Shrinking frees every block past the new
+ * end, whole extents at a time. Growing leaves a hole, which takes no disk
+ * blocks and reads as zeros. The offset of arg0 is not changed.
+ *
+ * Returns 0 on success, -1 on error.
+ *
+ * Error conditions:
+ * arg0 is not a regular file open for writing
+ * arg1 is negative
+ * the disk is full
+ */
+int sys_ftruncate(void);
+
+/*
+ * arg0: int [file descriptor]
+ * arg1: int [0 or FALLOC_FL_KEEP_SIZE (see inc/fcntl.h)]
+ * arg2: int [offset of the range to allocate]
+ * arg3: int [length of the range]
+ *
+ * Allocate disk blocks for bytes [arg2, arg2 + arg3) of a regular file,
+ * as one contiguous run when the disk has one, so later writes there need
+ * no allocation. Holes in the range are filled with zeroed blocks. The
+ * file grows to arg2 + arg3 bytes (zero filled) unless arg1 is
+ * FALLOC_FL_KEEP_SIZE, in which case the blocks past the end of the file
+ * wait for writes to reach them. ftruncate frees them again.
+ *
+ * Returns 0 on success, -1 on error.
+ *
+ * Error conditions:
+ * arg0 is not a regular file open for writing
+ * arg1 is not 0 or FALLOC_FL_KEEP_SIZE
+ * arg2 is negative or arg3 is not positive
+ * the disk is full
+ */
+int sys_fallocate(void);
+
+/*
+ * arg0: int [file descriptor to write to]
+ * arg1: int [file descriptor to read from]
+ * arg2: int [number of bytes]
+ *
+ * Copy up to arg2 bytes from arg1 to arg0 inside the kernel, like a read
+ * into a buffer followed by a write of it, but without the copies to and
+ * from user space. Either descriptor may be a pipe. The offsets of both
+ * descriptors move past the bytes copied.
+ *
+ * Returns the number of bytes copied, which is less than arg2 if arg1
+ * reaches its end (or its pipe's write end is closed), or -1 on error.
+ *
+ * Error conditions:
+ * arg1 is not open for reading or arg0 is not open for writing
+ * arg2 is negative
+ */
+int sys_sendfile(void);
+
+/*
+ * arg0: int [file descriptor of the clone]
+ * arg1: int [file descriptor of the file to clone]
+ *
+ * Replace the contents of the regular file at arg0 with those of arg1,
+ * sharing arg1's disk blocks instead of copying them. No file data is
+ * copied, only the extent map and a 2-byte reference count for each block
+ * (see rcinc and rcdrop in fs.c). Writing to either file afterwards gives
+ * it its own copy of the blocks written; the other file does not see the
+ * change.
+ *
+ * Returns 0 on success, -1 on error.
+ *
+ * Error conditions:
+ * arg0 is not a regular file open for writing
+ * arg1 is not a regular file open for reading
+ * arg0 and arg1 are the same file
+ * the disk is full
+ * a block of arg1 already has the largest reference count
+ */
+int sys_clone_file(void);
+
+/*
+ * arg0: int [file descriptor]
+ * arg1: uint * [set to the number of extents before]
+ * arg2: uint * [set to the number of extents after]
+ *
+ * Move the blocks of the regular file open at arg0 into one contiguous run
+ * of free disk blocks. Holes stay holes, so a sparse file keeps one extent
+ * per stretch of data between them. The data is copied first, and the new
+ * block map and the bitmap are updated in one log transaction, so a crash
+ * leaves the file either in its old blocks or in the new run. A file that
+ * is already contiguous is left alone.
+ *
+ * Returns 0 on success, -1 on error.
+ *
+ * Error conditions:
+ * arg0 is not a regular file
+ * arg1 or arg2 points to an invalid or unmapped address
+ * some blocks of the file are shared with a clone (see sys_clone_file)
+ * the file has more than 19 stretches of data between holes
+ * there is no free run long enough, which must lie in one bitmap block
+ * the blocks to update do not fit in one transaction
+ */
+int sys_defrag(void);
+
+/*
+ * arg0: int [file descriptor]
+ * arg1: struct fiemap * [set to the layout of the file (see inc/stat.h)]
+ * arg2: struct fiemap_extent * [array to fill with the file's extents]
+ * arg3: int [number of entries arg2 has room for, may be 0]
+ *
+ * Report how the file open at arg0 is laid out on disk: its allocated
+ * blocks, the number of extents and how many runs of them are contiguous
+ * on disk, and its first arg3 extents in file block order. Call with arg3
+ * set to 0 to learn arg1->nextents, the room needed for the whole map.
+ * Inline files and empty files have no extents.
+ *
+ * returns the number of extents copied to arg2, -1 on error
+ *
+ * Errors:
+ * arg0 is not a valid file descriptor
+ * arg0 is a pipe or a device
+ * arg1 or arg2 points to an invalid or unmapped address
+ * arg3 is negative or too large
+ */
+int sys_fiemap(void);
+
+/*
+ * arg0: char * [path of the directory to create]
+ *
+ * Create an empty directory holding only "." and "..". A relative path is
+ * looked up from the current directory (see sys_chdir).
+ *
+ * returns 0 on success, -1 on error
+ *
+ * Errors:
+ * arg0 points to an invalid or unmapped address
+ * there is an invalid address before the end of the string
+ * the path already exists
+ * a directory along the path does not exist
+ * the disk or the inodefile is full
+ */
+int sys_mkdir(void);
+
+/*
+ * arg0: char * [path of a directory]
+ *
+ * Make arg0 the current directory of the process, which relative paths
+ * are looked up from. A new process starts in the current directory of
+ * its parent, and the first process starts in the root.
+ *
+ * returns 0 on success, -1 on error
+ *
+ * Errors:
+ * arg0 points to an invalid or unmapped address
+ * there is an invalid address before the end of the string
+ * the path does not exist or is not a directory
+ */
+int sys_chdir(void);
+
+/*
+ * arg0: void * [address hint, ignored]
+ * arg1: int [number of bytes to map]
+ * arg2: int [PROT_READ, optionally | PROT_WRITE (see inc/mman.h)]
+ * arg3: int [MAP_SHARED or MAP_PRIVATE]
+ * arg4: int [file descriptor]
+ * arg5: int [file offset to map from, a multiple of the page size]
+ *
+ * Map arg1 bytes of the file open at arg4 into the address space. Pages are
+ * read from the file when first touched; bytes past the end of the file
+ * read as zero. Writes to a MAP_SHARED mapping are written back to the file
+ * (never past its end) by munmap or when the process exits or execs. Writes
+ * to a MAP_PRIVATE mapping stay in the process.
+ *
+ * Returns the address of the mapping, or -1 on error.
+ *
+ * Error conditions:
+ * arg4 is not a regular file open for reading
+ * arg3 is MAP_SHARED with PROT_WRITE and arg4 is not open for writing
+ * arg1 is not positive or arg5 is not page aligned
+ * the process already has NMMAP mappings, or no room for this one
+ */
+int sys_mmap(void);
+
+/*
+ * arg0: void * [address returned by mmap]
+ * arg1: int [length given to mmap]
+ *
+ * Remove a mapping, first writing back its dirty MAP_SHARED pages.
+ * Only whole mappings can be removed.
+ *
+ * Returns 0 on success, -1 if there is no mapping at arg0 of length arg1.
+ */
+int sys_munmap(void);
+
 // syscall.c
 int argint(int, int *);
 int argint64(int, int64_t *);
 int argptr(int, char **, int);
 int argstr(int, char **);
+int checkptr(uint64_t, int);
 int fetchint(uint64_t, int *);
 int fetchint64_t(uint64_t, int64_t *);
 int fetchstr(uint64_t, char **);
@@ -5,3 +5,18 @@ struct extent {
   uint startblkno; // start block number
   uint nblocks;    // n blocks following the start block
 };
+
+// A file that needs more extents than fit in its dinode switches to an
+// extent tree (DI_ETREE in fs.h). The dinode's data area then holds the root
+// node and every other node fills one disk block. A node is a header followed
+// by entries sorted by file block number.
+struct extent_header {
+  ushort nentries; // number of entries in use
+  ushort depth;    // height above the leaves, 0 for a leaf
+};
+
+struct extent_entry {
+  uint fbn;        // first file block covered by this entry
+  uint startblkno; // leaf: first disk block of the extent; else: child node
+  uint nblocks;    // leaf: blocks in the extent; else: unused
+};
@@ -6,3 +6,12 @@
 #define O_PIPERD 0x003
 #define O_PIPEWR 0x004
 #define O_CREATE 0x200
+#define O_DIRECT 0x400 // read whole blocks straight into the user buffer
+
+// lseek whence
+#define SEEK_SET 0 // offset is from the start of the file
+#define SEEK_CUR 1 // offset is from the current position
+#define SEEK_END 2 // offset is from the end of the file
+
+// fallocate mode
+#define FALLOC_FL_KEEP_SIZE 0x1 // reserve blocks without growing the file
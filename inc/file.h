@@ -3,6 +3,8 @@
 #include <extent.h>
 #include <sleeplock.h>
 
+struct iovec;
+
 // The in-memory inode structure. Every file within the `xk`
 // filesystem is represented by an in-memory inode. All `struct inode`s
 // correspond to an on-disk inode structure. For more info see `struct dinode`
@@ -29,6 +31,16 @@ struct inode {
   short devid;
   uint size;
   struct extent data[30];
+  ushort flags;
+
+  // In-memory name index for directories (see dirlookup in fs.c), built on
+  // first lookup. Protected by lock. Null for non-directories.
+  struct dirindex *dindex;
+
+  // Inode cache bookkeeping (see icache in fs.c), protected by icache.lock.
+  struct inode *hnext; // hash chain
+  struct inode *prev;  // LRU list of unreferenced inodes
+  struct inode *next;
 };
 
 // table mapping device ID (devid) to device functions
@@ -50,6 +62,18 @@ int fclose(int fd);
 int fstat(int fd, struct stat* file_stat);
 int fopen(char* path, int mode);
 int fpipe(int* fds);
+int fmmap(int fd, int length, int prot, int flags, int offset);
+int flseek(int fd, int offset, int whence);
+int fpread(int fd, char* buf, int n, int offset);
+int fpwrite(int fd, char* buf, int n, int offset);
+int freadv(int fd, struct iovec* iov, int iovcnt);
+int fwritev(int fd, struct iovec* iov, int iovcnt);
+int fftruncate(int fd, int length);
+int ffallocate(int fd, int mode, int offset, int len);
+int fsendfile(int outfd, int infd, int count);
+int fclone(int dstfd, int srcfd);
+int fdefrag(int fd, uint* before, uint* after);
+int ffiemap(int fd, struct fiemap* fm, struct fiemap_extent* ext, int n);
 
 
 // Pipe buffer
@@ -74,6 +98,7 @@ struct file_info {
   struct inode* node;
   int offset;
   int mode;
+  int flags; // O_DIRECT, kept apart from mode since modes are compared whole
   int reference;
   struct sleeplock lock;
   p_buf* buffer;
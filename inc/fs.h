@@ -7,12 +7,15 @@
 
 #define INODEFILEINO 0 // inode file inum
 #define ROOTINO 1      // root i-number
-#define BSIZE 512      // block size
+#define REFCNTINO 3    // block reference count file inum (after the console)
+#define MINBSIZE 512   // smallest block size, one disk sector
+#define MAXBSIZE 4096  // largest block size mkfs can choose
+#define SBOFF 512      // byte offset of the super block on disk
 
 struct logheader {
     int commit;
     uint data[79];
-    char padding[512 - ((sizeof(uint) * 79) + sizeof(int))];
+    char padding[MINBSIZE - ((sizeof(uint) * 79) + sizeof(int))];
 } typedef logheader;
 
 // Disk layout:
@@ -26,15 +29,19 @@ struct superblock {
   uint bmapstart;  // Block number of first free map block
   uint logstart;   // Block number of the log header
   uint inodestart; // Block number of the start of inode file
-  
+  uint bsize;      // Block size in bytes, a power of 2 (0 means MINBSIZE)
 };
 
+// The super block always sits at byte SBOFF of the disk so it can be found
+// before the block size is known: in block 1 when the block size is
+// MINBSIZE, and at the end of block 0 (the unused boot block) otherwise.
+
 // On-disk inode structure which tracks all necessary information which defines
 // a file. The inodefile is an array of `struct dinode`s
 // where the inode with inum `i` starts at file offset INODEOFF(i).
 //
 // NOTE(!): For atomicity purposes you must ensure that `sizeof(struct dinode)`
-// is a power of 2 and is <= BSIZE. (This ensures that it's always possible to
+// is a power of 2 and is <= MINBSIZE. (This ensures that it's always possible to
 // contiguously lay out `struct dinode`'s such that none ever span more than one
 // disk block).
 struct dinode {
@@ -47,19 +54,30 @@ struct dinode {
   // The size of the file in bytes.
   uint size;
   // The extent for the file's data. See `struct extent` in `extent.h` for more info.
+  // If DI_INLINE is set in flags, this area holds the file's bytes instead.
   struct extent data[30];
+  // Inode flags (DI_*).
+  ushort flags;
   // We pad the struct such that `sizeof(struct dinode)` is a power of 2.
-  char pad[8];
+  char pad[6];
 };
 
+// dinode flags
+#define DI_INLINE 0x1 // file data lives in the dinode's extent area
+#define DI_ETREE 0x2  // extent area holds the root of an extent tree
+#define DI_SHARED 0x4 // some blocks may be shared with clones (see REFCNTINO)
+
+// Largest file whose data can be stored inline in the dinode
+#define INLINESIZE (30 * sizeof(struct extent))
+
 // offset of inode in inodefile
 #define INODEOFF(inum) ((inum) * sizeof(struct dinode))
 
 // Bitmap bits per block
-#define BPB (BSIZE * 8)
+#define BPB(sb) ((sb).bsize * 8)
 
 // Block of free map containing bit for block b
-#define BBLOCK(b, sb) ((b) / BPB + (sb).bmapstart)
+#define BBLOCK(b, sb) ((b) / BPB(sb) + (sb).bmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
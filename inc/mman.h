@@ -0,0 +1,9 @@
+#pragma once
+
+// mmap protection
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+
+// mmap flags
+#define MAP_SHARED 0x1  // writes go back to the file
+#define MAP_PRIVATE 0x2 // writes stay in the process
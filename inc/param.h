@@ -5,7 +5,9 @@
 #define NCPU 8         // maximum number of CPUs
 #define NOFILE 16      // open files per process
 #define NFILE 100      // open files per system
-#define NINODE 50      // maximum number of active i-nodes
+#define NINODE 50      // minimum number of cached i-nodes
+#define NDINODE 65536  // maximum number of on-disk inodes (dirent inums are ushort)
+#define NDENTRY 128    // size of the path name (dentry) cache
 #define NDEV 10        // maximum major device number
 #define ROOTDEV 1      // device number of file system root disk
 #define MAXARG 32      // max exec arguments
@@ -13,6 +15,7 @@
 
 #define LOGSIZE (MAXOPBLOCKS * 3) // max data blocks in on-disk log
 #define NBUF (MAXOPBLOCKS * 3)    // size of disk block cache
-#define FSSIZE 50000             // size of file system in blocks
+#define NPCPAGE 64               // size of the file page cache
+#define FSSIZE 50000             // size of file system in 512-byte sectors
 #define MAXCODEPAGES 256
 #define MAXPATHLEN 20
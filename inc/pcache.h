@@ -0,0 +1,15 @@
+#pragma once
+
+// A page of file data in the page cache (see pcache.c).
+struct pcpage {
+  uint dev;
+  uint inum;               // 0 if unused (the inodefile is never cached here)
+  uint pgno;               // page number within the file
+  int ref;                 // users holding the page, protected by pcache.lock
+  int valid;               // data has been read from disk, protected by lock
+  struct sleeplock lock;   // held while the page is in use
+  char *data;              // the PGSIZE frame holding the data
+  struct pcpage *hnext;    // hash chain
+  struct pcpage *prev;     // LRU list
+  struct pcpage *next;
+};
@@ -108,6 +108,7 @@ struct proc {
   int killed;                         // If non-zero, have been killed
   char name[16];                      // Process name (debugging)
   file_info* infos[NOFILE];           // Array of open files for this process
+  struct inode *cwd;                  // Current directory, NULL for the root
 };
 
 // Process memory is laid out contiguously, low addresses first:
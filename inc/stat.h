@@ -10,3 +10,26 @@ struct stat {
   uint ino;   // Inode number
   uint size;  // Size of file in bytes
 };
+
+// Layout of a file on disk, filled in by fiemap.
+struct fiemap {
+  uint bsize;    // Block size in bytes
+  uint size;     // Size of file in bytes
+  uint flags;    // FIEMAP_* flags below
+  uint nextents; // Extents mapping the file's data
+  uint nblocks;  // Data blocks allocated, holes excluded
+  uint nnodes;   // Extent tree blocks holding the map
+  uint nfrags;   // Runs of extents that follow each other on disk
+};
+
+#define FIEMAP_INLINE 0x1 // data is stored in the inode, no blocks
+#define FIEMAP_TREE 0x2   // the map is an extent tree
+#define FIEMAP_SHARED 0x4 // some blocks may be shared with a clone
+
+// One extent of a file: nblocks file blocks from fbn on are stored in the
+// disk blocks from blkno on.
+struct fiemap_extent {
+  uint fbn;
+  uint blkno;
+  uint nblocks;
+};
@@ -22,3 +22,16 @@
 #define SYS_close 21
 #define SYS_sysinfo 22
 #define SYS_crashn 23
+#define SYS_mmap 24
+#define SYS_munmap 25
+#define SYS_lseek 26
+#define SYS_pread 27
+#define SYS_pwrite 28
+#define SYS_readv 29
+#define SYS_writev 30
+#define SYS_ftruncate 31
+#define SYS_fallocate 32
+#define SYS_sendfile 33
+#define SYS_clone_file 34
+#define SYS_defrag 35
+#define SYS_fiemap 36
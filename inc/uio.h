@@ -0,0 +1,9 @@
+#pragma once
+
+#define IOV_MAX 64 // most buffers in one readv or writev
+
+// One buffer of a readv or writev
+struct iovec {
+  void *iov_base; // start of the buffer
+  int iov_len;    // its length in bytes
+};
@@ -3,6 +3,7 @@
 struct stat;
 struct rtcdate;
 struct sys_info;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -28,6 +29,21 @@ int sleep(int);
 int uptime(void);
 int sysinfo(struct sys_info *);
 int crashn(int);
+void *mmap(void *, int, int, int, int, int);
+int munmap(void *, int);
+int lseek(int, int, int);
+int pread(int, void *, int, int);
+int pwrite(int, void *, int, int);
+int readv(int, struct iovec *, int);
+int writev(int, struct iovec *, int);
+int ftruncate(int, int);
+int fallocate(int, int, int, int);
+int sendfile(int, int, int);
+int clone_file(int, int);
+int defrag(int, uint *, uint *);
+struct fiemap;
+struct fiemap_extent;
+int fiemap(int, struct fiemap *, struct fiemap_extent *, int);
 
 // ulib.c
 int stat(char *, struct stat *);
@@ -3,14 +3,20 @@
 #include <defs.h>
 #include <mmu.h>
 
-#define NREGIONS 3
+#define NMMAP 4 // file mappings per process
+#define NREGIONS (3 + NMMAP)
 
 enum {
   VR_CODE   = 0,
   VR_HEAP   = 1,
   VR_USTACK = 2,
+  VR_MMAP   = 3, // first of the NMMAP regions used by mmap
 };
 
+// mmap places mappings between the heap and the stack, in [MMAPBASE, MMAPTOP)
+#define MMAPBASE SZ_1G
+#define MMAPTOP  (SZ_1G + SZ_1G / 2)
+
 #define VPI_PRESENT  ((short) 1)
 #define VPI_WRITABLE ((short) 1)
 #define VPI_READONLY ((short) 0)
@@ -22,6 +28,9 @@ struct vpage_info {
   short writable; // does the page have write permissions
   // user defined fields
   bool cow; // Copy on write
+  bool dirty; // shared file page written since it was loaded
+  uint foff;  // file offset the page loads from, if the region has a file
+  ushort fsz; // bytes of the page that come from the file, the rest is zero
 };
 
 #define VPIPPAGE ((PGSIZE/sizeof(struct vpage_info)) - 1)
@@ -45,6 +54,11 @@ struct vregion {
   uint64_t va_base;       // base of the region
   uint64_t size;          // size of region in bytes
   struct vpi_page *pages;  // pointer to array of page_infos
+  // File backing. Pages that are used but not present are read from ip
+  // on first touch (see vspacefault).
+  struct inode *ip;        // file the region maps, 0 if anonymous
+  bool shared;             // MAP_SHARED: dirty pages are written back to ip
+  bool canwrite;           // pages of a shared region may become writable
 };
 
 struct vspace {
@@ -32,9 +32,14 @@ int crashn = 0;
 
 int num_disk_reads = 0;
 
+// Size in bytes of a disk block. Starts out as one sector so the super
+// block can be read, then iinit sets it to the file system's block size.
+uint bsize = MINBSIZE;
+
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
+  uchar data[NBUF][MAXBSIZE];
 
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
@@ -50,6 +55,7 @@ void binit(void) {
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
   for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
+    b->data = bcache.data[b - bcache.buf];
     b->next = bcache.head.next;
     b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
@@ -58,6 +64,23 @@ void binit(void) {
   }
 }
 
+// Switch the block size to size. Cached buffers hold blocks of the old
+// size, so they are all dropped; none may be in use.
+void bsetsize(uint size) {
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for (b = bcache.head.next; b != &bcache.head; b = b->next) {
+    if (b->refcnt != 0 || (b->flags & B_DIRTY))
+      panic("bsetsize: buffer in use");
+    b->flags = 0;
+    b->blockno = 0;
+    b->dev = 0;
+  }
+  bsize = size;
+  release(&bcache.lock);
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
@@ -105,6 +128,55 @@ struct buf *bread(uint dev, uint blockno) {
   return b;
 }
 
+// Read block blockno straight from disk into dst, which must hold bsize
+// bytes and stay mapped in the kernel until the read is done. The buffer
+// cache is bypassed; it writes through, so the disk copy is never stale.
+void breaddirect(uint dev, uint blockno, uchar *dst) {
+  struct buf b;
+
+  num_disk_reads += 1;
+  memset(&b, 0, sizeof(b));
+  b.dev = dev;
+  b.blockno = blockno;
+  b.data = dst;
+  initsleeplock(&b.lock, "direct");
+  acquiresleep(&b.lock);
+  iderw(&b);
+  releasesleep(&b.lock);
+}
+
+// Write bsize bytes at src straight to block blockno on disk, bypassing the
+// buffer cache. A cached copy of the block would now be stale, so it is
+// dropped.
+void bwritedirect(uint dev, uint blockno, uchar *src) {
+  struct buf b, *c;
+
+  if (crashn_enable) {
+    crashn--;
+    if (crashn < 0)
+      reboot();
+  }
+
+  acquire(&bcache.lock);
+  for (c = bcache.head.next; c != &bcache.head; c = c->next) {
+    if (c->dev == dev && c->blockno == blockno && c->refcnt == 0) {
+      c->flags &= ~B_VALID;
+      break;
+    }
+  }
+  release(&bcache.lock);
+
+  memset(&b, 0, sizeof(b));
+  b.dev = dev;
+  b.blockno = blockno;
+  b.data = src;
+  b.flags = B_DIRTY;
+  initsleeplock(&b.lock, "direct");
+  acquiresleep(&b.lock);
+  iderw(&b);
+  releasesleep(&b.lock);
+}
+
 // Write b's contents to disk.  Must be locked.
 void bwrite(struct buf *b) {
   if (crashn_enable) {
@@ -146,11 +218,10 @@ void brelse(struct buf *b) {
 // Note: Data stored in blocks on disk are in little endian.
 void print_data_at_block(uint block) {
   cprintf("Printing data at block=%d\n", block);
-  uint64_t data[BSIZE / 8];
   struct buf* b = bread(ROOTDEV, block);
-  memmove(data, b->data, BSIZE);
-  brelse(b);
-  for (int i = 0; i < BSIZE/8; ++i) {
+  uint64_t *data = (uint64_t *)b->data;
+  for (int i = 0; i < bsize/8; ++i) {
     cprintf("block=0x%x index=%d: %lx\n", block, i, data[i]);
   }
+  brelse(b);
 }
\ No newline at end of file
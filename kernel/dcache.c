@@ -0,0 +1,174 @@
+// Directory entry (dentry) cache.
+//
+// Caches the result of looking up one path component: a (device, parent
+// directory inum, name) triple maps to the inum it names, or to 0 for a
+// negative entry recording that the name does not exist. namex consults the
+// cache before locking and scanning a directory, so resolving a hot path
+// (e.g. the binary exec'd on every shell command) touches no directory
+// blocks at all.
+//
+// Consistency: entries for a directory are only inserted or removed while
+// holding that directory's inode lock. dirlink and dirunlink in fs.c update
+// the cache as they change the directory on disk, so a cached entry always
+// matches the directory contents.
+//
+// Entries are kept on an LRU list; inserting into a full cache recycles the
+// least recently used entry.
+
+#include <cdefs.h>
+#include <defs.h>
+#include <fs.h>
+#include <param.h>
+#include <spinlock.h>
+
+#define NDHASH 64
+
+struct dentry {
+  uint dev;
+  uint parent;           // inum of the directory holding name
+  char name[DIRSIZ];
+  uint inum;             // inum that name refers to, 0 if it does not exist
+  int used;
+  struct dentry *hnext;  // hash chain
+  struct dentry *prev;   // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *buckets[NDHASH];
+
+  // Linked list of all dentries, through prev/next.
+  // head.next is most recently used.
+  struct dentry head;
+} dcache;
+
+void dcacheinit(void) {
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for (d = dcache.dentry; d < dcache.dentry + NDENTRY; d++) {
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+static uint dhash(uint dev, uint parent, char *name) {
+  uint h = dev * 31 + parent;
+  for (int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Find the dentry for (dev, parent, name). Caller must hold dcache.lock.
+static struct dentry *dfind(uint dev, uint parent, char *name) {
+  struct dentry *d;
+
+  for (d = dcache.buckets[dhash(dev, parent, name)]; d; d = d->hnext)
+    if (d->dev == dev && d->parent == parent && namecmp(name, d->name) == 0)
+      return d;
+  return 0;
+}
+
+// Remove d from its hash chain. Caller must hold dcache.lock.
+static void dunhash(struct dentry *d) {
+  struct dentry **pp;
+
+  for (pp = &dcache.buckets[dhash(d->dev, d->parent, d->name)]; *pp;
+       pp = &(*pp)->hnext) {
+    if (*pp == d) {
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->used = 0;
+}
+
+// Move d to the front (most recently used end) of the LRU list.
+// Caller must hold dcache.lock.
+static void dtouch(struct dentry *d) {
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.head.next;
+  d->prev = &dcache.head;
+  dcache.head.next->prev = d;
+  dcache.head.next = d;
+}
+
+// Look name up in directory parent. Returns 1 and sets *inum on a hit
+// (*inum is 0 if the name is known not to exist), 0 on a miss.
+int dcachelookup(uint dev, uint parent, char *name, uint *inum) {
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if (!(d = dfind(dev, parent, name))) {
+    release(&dcache.lock);
+    return 0;
+  }
+  *inum = d->inum;
+  dtouch(d);
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory parent refers to inum (0 for a negative
+// entry). Caller must hold the parent directory's inode lock.
+void dcacheinsert(uint dev, uint parent, char *name, uint inum) {
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if (!(d = dfind(dev, parent, name))) {
+    // Recycle the least recently used entry
+    d = dcache.head.prev;
+    if (d->used)
+      dunhash(d);
+    d->dev = dev;
+    d->parent = parent;
+    strncpy(d->name, name, DIRSIZ);
+    d->used = 1;
+    h = dhash(dev, parent, name);
+    d->hnext = dcache.buckets[h];
+    dcache.buckets[h] = d;
+  }
+  d->inum = inum;
+  dtouch(d);
+  release(&dcache.lock);
+}
+
+// Forget any entry for name in directory parent. Caller must hold the
+// parent directory's inode lock.
+void dcacheinvalidate(uint dev, uint parent, char *name) {
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if ((d = dfind(dev, parent, name))) {
+    dunhash(d);
+    // Make the entry the first to be recycled
+    d->next->prev = d->prev;
+    d->prev->next = d->next;
+    d->prev = dcache.head.prev;
+    d->next = &dcache.head;
+    dcache.head.prev->next = d;
+    dcache.head.prev = d;
+  }
+  release(&dcache.lock);
+}
+
+// Forget every entry for names in directory parent, which is being freed.
+// Caller must hold the directory's inode lock.
+void dcachepurge(uint dev, uint parent) {
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for (d = dcache.dentry; d < dcache.dentry + NDENTRY; d++)
+    if (d->used && d->dev == dev && d->parent == parent)
+      dunhash(d);
+  release(&dcache.lock);
+}
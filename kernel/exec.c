@@ -28,15 +28,19 @@ int exec(char *path, char **argv) {
   // Set up the new virtual spaces code with vspaceloadcode
     // The address of the file must be a valid .ELF file, and if it isn’t we return -1.
     // As a result, if we get a -1 here we should immediately exit after freeing the previously created vspace
-  if(vspaceloadcode(&vp, path, &rip) == -1)
+  if(vspaceloadcode(&vp, path, &rip) == -1) {
+    vspacefree(&vp);
     return -1;
+  }
 
 
   // Call vspaceinitstack to initialize the new virtual spaces unique stack
   // at the address SZ_2G.
     // If this returns -1 then we immediately exit and return -1 after freeing the previously created vspace
-  if(vspaceinitstack(&vp, SZ_2G) == -1)
+  if(vspaceinitstack(&vp, SZ_2G) == -1) {
+    vspacefree(&vp);
     return -1;
+  }
 
   // Next, we need to update the process’ registers before we start the processes main with vspaceinstall.
     // Use vspacewritetova VR_USTACK
@@ -124,7 +128,9 @@ int exec(char *path, char **argv) {
 
   // vspacedumpstack(&myproc()->vspace);
 
-  // Free the old vspace to avoid any memory leaks (vspacefree).
+  // Free the old vspace to avoid any memory leaks (vspacefree),
+  // writing back its shared file mappings first.
+  vspacesync(&old_space);
   vspacefree(&old_space);
 
   // Does not return on success
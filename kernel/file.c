@@ -7,11 +7,14 @@
 #include <file.h>
 #include <fs.h>
 #include <fcntl.h>
+#include <mman.h>
+#include <mmu.h>
 #include <param.h>
 #include <stat.h>
 #include <sleeplock.h>
 #include <spinlock.h>
 #include <proc.h>
+#include <uio.h>
 
 #define MAX(X, Y) (((X) < (Y)) ? (Y) : (X))
 
@@ -168,14 +171,25 @@ int fread(int fd, char* buf, int left_to_read) {
      return -1;
    }
     
+  // Nothing to read at or past the end of the file
+  if(process->infos[fd]->node->type == T_FILE
+     && process->infos[fd]->offset >= process->infos[fd]->node->size) {
+    releasesleep(&process->infos[fd]->lock);
+    return 0;
+  }
+
   // Reads as much as we can from the file
   if((process->infos[fd]->node->size - process->infos[fd]->offset) < left_to_read) {
     left_to_read = process->infos[fd]->node->size - process->infos[fd]->offset;
   }
   
   // Read as much as possible (num_read) from a given file into buf
-  num_read = concurrent_readi(process->infos[fd]->node, buf,
-                              process->infos[fd]->offset, left_to_read);
+  if (process->infos[fd]->flags & O_DIRECT)
+    num_read = concurrent_readi_direct(process->infos[fd]->node, buf,
+                                       process->infos[fd]->offset, left_to_read);
+  else
+    num_read = concurrent_readi(process->infos[fd]->node, buf,
+                                process->infos[fd]->offset, left_to_read);
 
   // If num_read is -1 then an error has likely occurred and we
   // test to see if the value is bad
@@ -332,6 +346,11 @@ int fopen(char* path, int mode) {
   // LAB1
   
   struct file_info fi;
+
+  // O_DIRECT only changes how reads are done, keep it out of the mode
+  fi.flags = mode & O_DIRECT;
+  mode &= ~O_DIRECT;
+
   // Check if we are opening a pipe. If we aren't, we need specific data
   if(mode == O_PIPERD || mode == O_PIPEWR) {
     
@@ -393,6 +412,272 @@ int fopen(char* path, int mode) {
 }
 
 
+int flseek(int fd, int offset, int whence) {
+  struct proc* process = myproc();
+  file_info* info = process->infos[fd];
+  struct stat st;
+  int base;
+
+  // Pipes have no position
+  if(info == NULL || info->node == NULL)
+    return -1;
+
+  acquiresleep(&info->lock);
+
+  concurrent_stati(info->node, &st);
+  if(whence == SEEK_SET) {
+    base = 0;
+  } else if(whence == SEEK_CUR) {
+    base = info->offset;
+  } else if(whence == SEEK_END) {
+    base = st.size;
+  } else {
+    releasesleep(&info->lock);
+    return -1;
+  }
+
+  // The position may pass the end of the file; writing there leaves a hole
+  if(base + offset < 0) {
+    releasesleep(&info->lock);
+    return -1;
+  }
+  info->offset = base + offset;
+
+  releasesleep(&info->lock);
+  return base + offset;
+}
+
+int fpread(int fd, char* buf, int n, int offset) {
+  file_info* info = myproc()->infos[fd];
+  struct stat st;
+
+  if(info == NULL || info->node == NULL || n < 0 || offset < 0)
+    return -1;
+  if(info->mode != O_RDONLY && info->mode != O_RDWR)
+    return -1;
+
+  // The file's lock and offset are left alone, so positional reads of one
+  // descriptor only serialize on the inode lock inside readi
+  concurrent_stati(info->node, &st);
+  if(n == 0 || (st.type == T_FILE && offset >= st.size))
+    return 0;
+
+  if(info->flags & O_DIRECT)
+    return concurrent_readi_direct(info->node, buf, offset, n);
+  return concurrent_readi(info->node, buf, offset, n);
+}
+
+int fpwrite(int fd, char* buf, int n, int offset) {
+  file_info* info = myproc()->infos[fd];
+
+  if(info == NULL || info->node == NULL || n < 0 || offset < 0)
+    return -1;
+  if(info->mode != O_WRONLY && info->mode != O_RDWR)
+    return -1;
+  if(n == 0)
+    return 0;
+
+  return concurrent_writei(info->node, buf, offset, n);
+}
+
+int freadv(int fd, struct iovec* iov, int iovcnt) {
+  file_info* info = myproc()->infos[fd];
+  int i, n, tot;
+
+  if(info == NULL)
+    return -1;
+
+  // Pipes are read one buffer at a time
+  if(info->node == NULL) {
+    for(i = 0, tot = 0; i < iovcnt; i++) {
+      if((n = fread(fd, iov[i].iov_base, iov[i].iov_len)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += n;
+      if(n < iov[i].iov_len)
+        break;
+    }
+    return tot;
+  }
+
+  acquiresleep(&info->lock);
+
+  if(info->mode != O_RDONLY && info->mode != O_RDWR) {
+    releasesleep(&info->lock);
+    return -1;
+  }
+
+  // One trip through the file and inode locks for all of the buffers
+  n = concurrent_readvi(info->node, iov, iovcnt, info->offset,
+                        info->flags & O_DIRECT);
+  if(n > 0)
+    info->offset += n;
+
+  releasesleep(&info->lock);
+  return n;
+}
+
+int fwritev(int fd, struct iovec* iov, int iovcnt) {
+  file_info* info = myproc()->infos[fd];
+  int i, n, tot;
+
+  if(info == NULL)
+    return -1;
+
+  // Pipes are written one buffer at a time
+  if(info->node == NULL) {
+    for(i = 0, tot = 0; i < iovcnt; i++) {
+      if(iov[i].iov_len == 0)
+        continue;
+      if((n = fwrite(fd, iov[i].iov_base, iov[i].iov_len)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += n;
+    }
+    return tot;
+  }
+
+  acquiresleep(&info->lock);
+
+  if(info->mode != O_WRONLY && info->mode != O_RDWR) {
+    releasesleep(&info->lock);
+    return -1;
+  }
+
+  n = concurrent_writevi(info->node, iov, iovcnt, info->offset);
+  if(n > 0)
+    info->offset += n;
+
+  releasesleep(&info->lock);
+  return n;
+}
+
+int fmmap(int fd, int length, int prot, int flags, int offset) {
+  struct proc* process = myproc();
+  file_info* info = process->infos[fd];
+  struct stat st;
+  uint64_t va;
+
+  if(info == NULL || info->node == NULL)
+    return -1;
+
+  if(length <= 0 || offset < 0 || offset % PGSIZE != 0
+     || (flags != MAP_SHARED && flags != MAP_PRIVATE))
+    return -1;
+
+  acquiresleep(&info->lock);
+
+  // Only regular files can be mapped. Pages are always readable, and
+  // writing through a shared mapping needs the file open for writing.
+  concurrent_stati(info->node, &st);
+  if(st.type != T_FILE
+     || (info->mode != O_RDONLY && info->mode != O_RDWR)
+     || ((prot & PROT_WRITE) && flags == MAP_SHARED && info->mode != O_RDWR)) {
+    releasesleep(&info->lock);
+    return -1;
+  }
+
+  va = vspacemmap(&process->vspace, info->node, offset, length,
+                  prot & PROT_WRITE, flags == MAP_SHARED);
+
+  releasesleep(&info->lock);
+
+  if(va == 0)
+    return -1;
+  return va;
+}
+
+int fftruncate(int fd, int length) {
+  file_info* info = myproc()->infos[fd];
+
+  if(info == NULL || info->node == NULL || length < 0)
+    return -1;
+  if(info->mode != O_WRONLY && info->mode != O_RDWR)
+    return -1;
+
+  return concurrent_truncatei(info->node, length);
+}
+
+int ffallocate(int fd, int mode, int offset, int len) {
+  file_info* info = myproc()->infos[fd];
+
+  if(info == NULL || info->node == NULL || offset < 0 || len <= 0
+     || offset + len < offset)
+    return -1;
+  if(mode != 0 && mode != FALLOC_FL_KEEP_SIZE)
+    return -1;
+  if(info->mode != O_WRONLY && info->mode != O_RDWR)
+    return -1;
+
+  return concurrent_allocatei(info->node, offset, len,
+                              mode == FALLOC_FL_KEEP_SIZE);
+}
+
+// Move up to count bytes from infd to outfd a page at a time through a
+// kernel buffer, so the data never passes through user space. Either end
+// may be a pipe; reading from a pipe stops when its write end is closed.
+int fsendfile(int outfd, int infd, int count) {
+  struct proc* process = myproc();
+  char* kbuf;
+  int n, m, tot;
+
+  if(process->infos[infd] == NULL || process->infos[outfd] == NULL
+     || count < 0)
+    return -1;
+  if((kbuf = kalloc()) == NULL)
+    return -1;
+
+  for(tot = 0; tot < count; tot += m) {
+    if((n = fread(infd, kbuf, min(count - tot, (int) PGSIZE))) <= 0) {
+      if(n < 0 && tot == 0)
+        tot = -1;
+      break;
+    }
+    if((m = fwrite(outfd, kbuf, n)) < 0) {
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    if(m < n) {
+      tot += m;
+      break;
+    }
+  }
+
+  kfree(kbuf);
+  return tot;
+}
+
+int fclone(int dstfd, int srcfd) {
+  struct proc* process = myproc();
+  file_info* dst = process->infos[dstfd];
+  file_info* src = process->infos[srcfd];
+
+  if(dst == NULL || dst->node == NULL || src == NULL || src->node == NULL)
+    return -1;
+  if((dst->mode != O_WRONLY && dst->mode != O_RDWR)
+     || (src->mode != O_RDONLY && src->mode != O_RDWR))
+    return -1;
+
+  return concurrent_clonei(dst->node, src->node);
+}
+
+int fdefrag(int fd, uint* before, uint* after) {
+  file_info* info = myproc()->infos[fd];
+
+  if(info == NULL || info->node == NULL)
+    return -1;
+
+  return concurrent_defragi(info->node, before, after);
+}
+
+int ffiemap(int fd, struct fiemap* fm, struct fiemap_extent* ext, int n) {
+  file_info* info = myproc()->infos[fd];
+
+  if(info == NULL || info->node == NULL)
+    return -1;
+
+  return concurrent_fiemapi(info->node, fm, ext, n);
+}
+
 static int add_global_file(file_info info) {
 
   // Find an index in our infos list that we can store tha value in
@@ -21,6 +21,8 @@
 #include <stat.h>
 #include <fcntl.h>
 #include <buf.h>
+#include <pcache.h>
+#include <uio.h>
 
 
 // there should be one superblock per disk device, but we run with
@@ -32,30 +34,52 @@ struct superblock sb;
 void readsb(int dev, struct superblock *sb) {
   struct buf *bp;
 
-  bp = bread(dev, 1);
-  memmove(sb, bp->data, sizeof(*sb));
+  bp = bread(dev, SBOFF / bsize);
+  memmove(sb, bp->data + SBOFF % bsize, sizeof(*sb));
   brelse(bp);
 }
 
-// Find the offset of the first empty position in the root directory for a dirent
-// and adds the parameter dirent there. Returns -1 on failure and the offset in
-// the directory on success
-static int findemptydirentoffset();
+// Find the in-memory inode for inum on dev, see definition below.
+static struct inode *iget(uint dev, uint inum);
 
-// Find the offset of the first empty position in the inodefile for a dinode
-// and adds the parameter dinode there. Returns -1 on failure and the offset
-// in the file on success
-static int 
-findemptyinodeoffset(struct dinode* di);
+// Free the directory index hanging off of ip, if any.
+static void dindex_drop(struct inode *ip);
 
-// Write to an inode's file at a given offset using the src arrays data
-// If the offset extends beyond currently allocated space for
-// the file then balloc new blocks for the file
-static int writetoextent(struct inode* node, char* src, int off, int n);
+// Allocate an unused inum from the free-inode bitmap and write the passed
+// dinode to its slot in the inodefile. Returns -1 on failure and the inum
+// on success
+static int ialloc(struct dinode* di);
 
-// Read from an inode's file data at a given offset and places
-// the results in the dst array
-static int readfromextent(struct inode* node, char* dst, int off, int n);
+// Mark the inum as free in the free-inode bitmap so a later ialloc can
+// reuse it. The caller is responsible for clearing the on-disk dinode.
+static void ifree(uint inum);
+
+
+// Allocate blocks for the unmapped file blocks in [from, to) of ip.
+// Returns the number of blocks added, or -1 if the disk is full
+static int imapblocks(struct inode *ip, uint from, uint to, uint wfrom,
+                      uint wto);
+
+// Free all of the data blocks (and extent tree nodes) of ip
+static void itrunc(struct inode *ip);
+static int itruncate(struct inode *ip, uint size);
+
+// Copy the shared blocks a write to bytes [off, off + n) of ip touches
+static int iunshare(struct inode *ip, uint off, uint n);
+
+// Whether the data of ip goes through the page cache. The inodefile and
+// directories are metadata and stay in the buffer cache.
+static bool ipcached(struct inode *ip) {
+  return ip->type == T_FILE && ip->inum != INODEFILEINO;
+}
+
+// Body of readi. If direct, dst is a user address and whole blocks are read
+// into it without going through the buffer cache
+static int readi_common(struct inode *ip, char *dst, uint off, uint n,
+                        bool direct);
+
+// Move a file's inline data out of the dinode and into extents
+static int inlinetoextent(struct inode *ip);
 
 /*
  * arg0: char * [path to the file]
@@ -69,11 +93,14 @@ static int readfromextent(struct inode* node, char* dst, int off, int n);
  * arg0 points to an invalid or unmapped address
  * there is an invalid address before the end of the string
  * the file does not exist
- * the path represents a directory or device
+ * the path represents a device, a directory that is not empty, "." or ".."
  * the file currently has an open reference
  */
 int unlink(char*);
 
+// Whether directory dp has no entries besides "." and ".."
+static bool isdirempty(struct inode *dp);
+
 
 // mark [start, end] bit in bp->data to 1 if used is true, else 0
 static void bmark(struct buf *bp, uint start, uint end, bool used)
@@ -94,59 +121,207 @@ static void bmark(struct buf *bp, uint start, uint end, bool used)
 
 // Blocks.
 
-// Allocate n disk blocks, no promise on content of allocated disk blocks
-// Returns the beginning block number of a consecutive chunk of n blocks
-// __attribute__((unused)) suppresses unused warning, can be removed once this
-// function is called in lab 4.
-static uint balloc(uint dev, uint n)
+// The run of blocks defrag is copying a file into (see breserve). It is
+// reserved in memory only, so the bitmap on disk never shows it in use
+// before the transaction that hands it to the file commits. start and n
+// change only while the bitmap block covering the run is held.
+static struct {
+  struct sleeplock owner; // held by the defrag using the reservation
+  struct spinlock lock;   // protects start and n
+  uint start, n;          // n is 0 if nothing is reserved
+} bresv;
+
+// Set [*lo, *hi) to the bits of the bitmap block covering the blocks from
+// b on that are reserved for defrag, an empty range if none are.
+static void bresvbits(uint b, uint *lo, uint *hi)
+{
+  acquire(&bresv.lock);
+  *lo = *hi = 0;
+  if (bresv.n > 0 && BBLOCK(bresv.start, sb) == BBLOCK(b, sb)) {
+    *lo = bresv.start % BPB(sb);
+    *hi = *lo + bresv.n;
+  }
+  release(&bresv.lock);
+}
+
+// Look through bitmap block bp, which covers the blocks from b on, for a run
+// of n free blocks, or if partial is set for the first free run when there
+// is no such run. Sets *got to the length of the run and returns its first
+// bit, or returns -1 if there is none.
+static int bscan(struct buf *bp, uint b, uint n, bool partial, uint *got)
+{
+  int bi, m;
+  uint sz = 0;
+  uint i = 0;
+  uint lo, hi;
+
+  bresvbits(b, &lo, &hi);
+  for (bi = 0; bi < BPB(sb) && b + bi < sb.size; bi++) {
+    m = 1 << (bi % 8);
+    // Is block free?
+    if ((bp->data[bi/8] & m) == 0 && (bi < lo || bi >= hi)) {
+      sz++;
+      if (sz == 1) // reset starting blk
+        i = bi;
+      if (sz == n) // found n blks
+        break;
+    } else if (partial && sz > 0) { // take the first run
+      break;
+    } else { // reset search
+      sz = 0;
+      i = 0;
+    }
+  }
+
+  if (sz == n || (partial && sz > 0)) {
+    *got = sz;
+    return i;
+  }
+  return -1;
+}
+
+// Allocate a run of up to n contiguous disk blocks, no promise on content
+// of allocated disk blocks. A run of all n blocks is preferred; if there is
+// none, the first free run is taken. Sets *got to the length of the run and
+// returns its first block number, or returns 0 if the disk is full.
+static uint balloc(uint dev, uint n, uint *got)
 {
-  int b, bi, m;
+  int b, i;
   struct buf *bp;
+  int pass;
 
-  bp = 0;
-  for (b = 0; b < sb.size; b += BPB) {
-    bp = bread(dev, BBLOCK(b, sb)); // look through each bitmap sector
-
-    uint sz = 0;
-    uint i = 0;
-    for (bi = 0; bi < BPB && b + bi < sb.size; bi++) {
-      m = 1 << (bi % 8);
-      if ((bp->data[bi/8] & m) == 0) {  // Is block free?
-        sz++;
-        if (sz == 1) // reset starting blk
-          i = bi;
-        if (sz == n) { // found n blks
-          bmark(bp, i, bi, true); // mark data block as used
-          
-          // flush the buffer to disk
-          bwrite(bp);
-          brelse(bp);
-          return b+i;
-        }
-      } else { // reset search
-        sz = 0;
-        i = 0;
+  for (pass = 0; pass < 2; pass++) {
+    for (b = 0; b < sb.size; b += BPB(sb)) {
+      bp = bread(dev, BBLOCK(b, sb)); // look through each bitmap sector
+      if ((i = bscan(bp, b, n, pass == 1, got)) >= 0) {
+        bmark(bp, i, i + *got - 1, true); // mark data block as used
+
+        // flush the buffer to disk
+        bwrite(bp);
+        brelse(bp);
+        return b+i;
       }
+      brelse(bp);
     }
-    brelse(bp);
   }
-  panic("balloc: can't allocate contiguous blocks");
+  *got = 0;
+  return 0;
 }
 
-// Free n disk blocks starting from b.
-// __attribute__((unused)) suppresses unused warning, can be removed once this
-// function is called in lab 4.
-static void bfree(int dev, uint b, uint n)
+// Reserve a run of exactly n free blocks for defrag, which must hold
+// bresv.owner. balloc, bextend and breserve pass over the run, but it is
+// left free in the bitmap, for the transaction that moves the file into it
+// to mark. Returns the first block of the run, or 0 if there is no such run
+// within one bitmap block.
+static uint breserve(uint dev, uint n)
 {
+  int b, i;
   struct buf *bp;
+  uint got;
+
+  for (b = 0; b < sb.size; b += BPB(sb)) {
+    bp = bread(dev, BBLOCK(b, sb));
+    if ((i = bscan(bp, b, n, false, &got)) >= 0) {
+      acquire(&bresv.lock);
+      bresv.start = b + i;
+      bresv.n = n;
+      release(&bresv.lock);
+      brelse(bp);
+      return b+i;
+    }
+    brelse(bp);
+  }
+  return 0;
+}
 
-  assertm(n >= 1, "freeing less than 1 block");
-  assertm(BBLOCK(b, sb) == BBLOCK(b+n-1, sb), "returned blocks live in different bitmap sectors");
+// Drop the reservation breserve made. The caller must hold the bitmap
+// block covering it, with the run marked in use.
+static void bunreserve(void)
+{
+  acquire(&bresv.lock);
+  bresv.n = 0;
+  release(&bresv.lock);
+}
+
+// Allocate up to n blocks starting exactly at block b, so that an extent
+// ending just before b can grow in place. Stops at the first block in use
+// and at the end of b's bitmap block. Returns the number of blocks taken.
+static uint bextend(uint dev, uint b, uint n)
+{
+  struct buf *bp;
+  uint bi, sz, lo, hi;
 
   bp = bread(dev, BBLOCK(b, sb));
-  bmark(bp, b % BPB, (b+n-1) % BPB, false);
-  bwrite(bp);
+  bresvbits(b, &lo, &hi);
+  for (sz = 0, bi = b % BPB(sb); sz < n && bi < BPB(sb) && b + sz < sb.size;
+       sz++, bi++) {
+    if ((bp->data[bi/8] & (1 << (bi % 8))) || (bi >= lo && bi < hi))
+      break;
+  }
+  if (sz > 0) {
+    bmark(bp, b % BPB(sb), b % BPB(sb) + sz - 1, true);
+    bwrite(bp);
+  }
   brelse(bp);
+  return sz;
+}
+
+// Frees runs of disk blocks in bulk. A run in the bitmap block of the run
+// before it is marked in the buffer already held, so freeing a file's
+// extents writes each bitmap block once rather than once per extent.
+struct bfreebatch {
+  uint dev;
+  struct buf *bp; // bitmap block being updated, 0 if none
+};
+
+// Free n disk blocks starting from b as part of batch fb.
+static void bfreerun(struct bfreebatch *fb, uint b, uint n)
+{
+  uint m;
+
+  assertm(n >= 1, "freeing less than 1 block");
+
+  // An extent grown in place may span bitmap blocks
+  while (n > 0) {
+    m = min(n, BPB(sb) - b % BPB(sb));
+    if (fb->bp && fb->bp->blockno != BBLOCK(b, sb)) {
+      bwrite(fb->bp);
+      brelse(fb->bp);
+      fb->bp = 0;
+    }
+    if (!fb->bp)
+      fb->bp = bread(fb->dev, BBLOCK(b, sb));
+    bmark(fb->bp, b % BPB(sb), b % BPB(sb) + m - 1, false);
+    b += m;
+    n -= m;
+  }
+}
+
+// Write out the last bitmap block of batch fb.
+static void bfreeflush(struct bfreebatch *fb)
+{
+  if (fb->bp) {
+    bwrite(fb->bp);
+    brelse(fb->bp);
+    fb->bp = 0;
+  }
+}
+
+// Free n disk blocks starting from b.
+static void bfree(int dev, uint b, uint n)
+{
+  struct bfreebatch fb = {dev, 0};
+
+  bfreerun(&fb, b, n);
+  bfreeflush(&fb);
+}
+
+static uchar zeroblk[MAXBSIZE];
+
+// Zero disk block b.
+static void bzero(uint dev, uint b)
+{
+  bwritedirect(dev, b, zeroblk);
 }
 
 // Inodes.
@@ -167,6 +342,12 @@ static void bfree(int dev, uint b, uint n)
 // inodes include book-keeping information that is
 // not stored on disk: ip->ref and ip->flags.
 //
+// The cache is a hash table keyed by (dev, inum) and is sized
+// from physical memory at boot. An inode whose last reference
+// is dropped stays valid on an LRU list, so reopening it does
+// not read its dinode from disk again. iget recycles the least
+// recently used unreferenced inode when it needs a new entry.
+//
 // Since there is no writing to the file system there is no need
 // for the callers to worry about coherence between the disk
 // and the in memory copy, although that will become important
@@ -180,13 +361,37 @@ static void bfree(int dev, uint b, uint n)
 
 
 
+#define NIHASH 128
+
+// Pages of physical memory per page of cached inodes.
+#define IPAGERATIO 256
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  uint ninode;
+  struct inode *buckets[NIHASH];
+
+  // Linked list of unreferenced inodes, through prev/next.
+  // lru.next is most recently used.
+  struct inode lru;
+
   struct inode inodefile;
-  struct sleeplock openlock;
+  struct inode *root;
+  struct inode *refcnt; // block reference counts, see rcinc
 } icache;
 
+// Free-inode bitmap. Built once at mount time by scanning the inodefile so
+// that creates do not have to rescan it looking for a dinode with type -1.
+// A set bit means the inum is in use. `ninodes` is the number of dinode
+// slots currently in the inodefile and `hint` is a lower bound on the first
+// clear bit, so allocation is O(1) amortized.
+struct {
+  struct spinlock lock;
+  uchar map[NDINODE / 8];
+  uint ninodes;
+  uint hint;
+} imap;
+
 // Find the inode file on the disk and load it into memory
 // should only be called once, but is idempotent.
 static void init_inodefile(int dev) {
@@ -204,6 +409,7 @@ static void init_inodefile(int dev) {
 
   icache.inodefile.devid = di.devid;
   icache.inodefile.size = di.size;
+  icache.inodefile.flags = di.flags;
   for(int i = 0; i < 30; i++) {
     icache.inodefile.data[i] = di.data[i];
   }
@@ -211,20 +417,92 @@ static void init_inodefile(int dev) {
   brelse(b);
 }
 
-void iinit(int dev) {
-  int i;
+// Build the free-inode bitmap from the inodefile. A dinode slot is free if
+// it was released by unlink (type -1) or never written (type 0).
+static void init_imap(void) {
+  struct dinode dinodes[MINBSIZE / sizeof(struct dinode)];
+  uint inum, off, i, n;
 
-  initlock(&icache.lock, "icache");
-  for (i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
+  initlock(&imap.lock, "imap");
+  memset(imap.map, 0, sizeof(imap.map));
+  imap.ninodes = icache.inodefile.size / sizeof(struct dinode);
+  if (imap.ninodes > NDINODE)
+    panic("init_imap: too many inodes");
+
+  locki(&icache.inodefile);
+  for (off = 0; off < icache.inodefile.size; off += sizeof(dinodes)) {
+    n = min((uint)sizeof(dinodes), icache.inodefile.size - off);
+    if (readi(&icache.inodefile, (char *)dinodes, off, n) != n)
+      panic("init_imap: read inodefile");
+    for (i = 0; i < n / sizeof(struct dinode); i++) {
+      inum = off / sizeof(struct dinode) + i;
+      if (dinodes[i].type > 0)
+        imap.map[inum / 8] |= 1 << (inum % 8);
+    }
+  }
+  unlocki(&icache.inodefile);
+
+  imap.hint = 0;
+}
+
+// Allocate the inode cache, one page of inodes per IPAGERATIO pages of
+// physical memory but at least NINODE inodes, and put every inode on the
+// LRU list.
+static void init_icache(void) {
+  struct inode *page, *ip;
+  uint npg, per, i;
+
+  icache.lru.prev = &icache.lru;
+  icache.lru.next = &icache.lru;
+
+  per = PGSIZE / sizeof(struct inode);
+  npg = max((uint)npages / IPAGERATIO, (NINODE + per - 1) / per);
+  for (i = 0; i < npg; i++) {
+    if (!(page = (struct inode *)kalloc()))
+      break;
+    memset(page, 0, PGSIZE);
+    for (ip = page; ip < page + per; ip++) {
+      initsleeplock(&ip->lock, "inode");
+      ip->next = icache.lru.next;
+      ip->prev = &icache.lru;
+      icache.lru.next->prev = ip;
+      icache.lru.next = ip;
+      icache.ninode++;
+    }
   }
+  if (icache.ninode < NINODE)
+    panic("init_icache: out of memory");
+}
+
+void iinit(int dev) {
+  initlock(&icache.lock, "icache");
+  init_icache();
   initsleeplock(&icache.inodefile.lock, "inodefile");
+  initsleeplock(&bresv.owner, "defrag");
+  initlock(&bresv.lock, "bresv");
 
   readsb(dev, &sb);
-  cprintf("sb: size %d nblocks %d bmap start %d inodestart %d\n", sb.size,
-          sb.nblocks, sb.bmapstart, sb.inodestart);
+  if (sb.bsize == 0)
+    sb.bsize = MINBSIZE;
+  if (sb.bsize < MINBSIZE || sb.bsize > MAXBSIZE ||
+      (sb.bsize & (sb.bsize - 1)) != 0)
+    panic("iinit: bad block size");
+  if (sb.bsize != bsize)
+    bsetsize(sb.bsize);
+
+  // Finish a log transaction a crash interrupted
+  logapply();
+  cprintf("sb: size %d nblocks %d bmap start %d inodestart %d bsize %d\n",
+          sb.size, sb.nblocks, sb.bmapstart, sb.inodestart, sb.bsize);
+  cprintf("icache: %d inodes\n", icache.ninode);
 
   init_inodefile(dev);
+  init_imap();
+
+  // Keep the root directory cached (and with it, its directory index)
+  // for the life of the system.
+  icache.root = iget(dev, ROOTINO);
+  icache.refcnt = iget(dev, REFCNTINO);
 }
 
 
@@ -254,36 +532,75 @@ static void write_dinode(uint inum, struct dinode *dip) {
     unlocki(&icache.inodefile);
 }
 
+// Fill in *dip from in-memory inode ip.
+static void idinode(struct inode *ip, struct dinode *dip) {
+  memset(dip, 0, sizeof(*dip));
+  dip->type = ip->type;
+  dip->devid = ip->devid;
+  dip->size = ip->size;
+  dip->flags = ip->flags;
+  memmove(dip->data, ip->data, 30 * sizeof(struct extent));
+}
+
+// Copy a modified in-memory inode to its dinode on disk.
+// Caller must hold ip->lock.
+static void iupdate(struct inode *ip) {
+  struct dinode di;
+
+  idinode(ip, &di);
+  write_dinode(ip->inum, &di);
+}
+
+
+static uint ihash(uint dev, uint inum) {
+  return (dev * 31 + inum) % NIHASH;
+}
+
+// Unlink ip from the LRU list. Caller must hold icache.lock.
+static void lru_remove(struct inode *ip) {
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
 
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not read
 // the inode from from disk.
 static struct inode *iget(uint dev, uint inum) {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for (ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++) {
-    if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
+  for (ip = icache.buckets[ihash(dev, inum)]; ip; ip = ip->hnext) {
+    if (ip->dev == dev && ip->inum == inum) {
+      if (ip->ref == 0)
+        lru_remove(ip);
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if (empty == 0 && ip->ref == 0) // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if (empty == 0)
+  // Recycle the least recently used unreferenced inode.
+  ip = icache.lru.prev;
+  if (ip == &icache.lru)
     panic("iget: no inodes");
+  lru_remove(ip);
+
+  for (pp = &icache.buckets[ihash(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext) {
+    if (*pp == ip) {
+      *pp = ip->hnext;
+      break;
+    }
+  }
+  dindex_drop(ip);
 
-  ip = empty;
   ip->ref = 1;
   ip->valid = 0;
   ip->dev = dev;
   ip->inum = inum;
+  ip->hnext = icache.buckets[ihash(dev, inum)];
+  icache.buckets[ihash(dev, inum)] = ip;
 
   release(&icache.lock);
 
@@ -291,175 +608,137 @@ static struct inode *iget(uint dev, uint inum) {
 }
 
 // looks up a path, if valid, populate its inode struct
+//
+// There is no global lock around opens. Looking up an existing file only
+// locks one directory at a time in namex (or none, on a dentry cache hit).
+// Only creating a file locks its parent directory, for the re-check and
+// the dirent write, so creates in different directories run in parallel.
 struct inode *iopen(char *path, int mode) {
-  
-  acquiresleep(&icache.openlock);
-  
-  struct inode* inode = namei(path);
-  if (inode != NULL) {
+  char name[DIRSIZ];
+  struct inode* dir;
+  struct inode* inode;
+
+  if ((inode = namei(path)) != NULL) {
     locki(inode);
     unlocki(inode);
-  } else if(O_CREATE == (O_CREATE & mode)) {  // The file does not already exist
-   
-    
-    // Construct a struct dinode called din
-    struct dinode di;
-    // Update the din with the correct information.
-    // Type will always be that of file, size will be that of 0,
-    // the devid will be the DEVROOT constant (since we only have 1 drive),
-    // data will not be modified since it starts empty, and
-    // pad will likewise not be modified.
-    di.type = T_FILE;
-    di.devid = ROOTDEV;
-    di.size = 0;
-    memset(di.data, 0, sizeof(struct extent) * 30);
-
-    // Iterate through the inodefile until we find a position to add our new files dinode data
-    int inodepos = findemptyinodeoffset(&di);
-    if(inodepos == -1) {
-      //releasesleep(&icache.openlock);
-      return NULL;  
-    }
+    return inode;
+  }
 
-    // Add new file to the free position in the inodefile
-    write_dinode(inodepos / sizeof(struct dinode), &di);
- 
-    // Create the dirent we are adding to the rootdir
-    struct dirent entry;
-    memset(&entry, 0, sizeof(struct dirent));
-    int size = strlen(path);
-    for(int i = 0; i < size && i < DIRSIZ; i++) {
-      entry.name[i] = path[i];
-    }
-    entry.name[size+1] = '\0';
-    entry.inum = inodepos / sizeof(struct dinode);
-
-    // Acquire the rootdir, concurrent_writei onto the end of it
-    // a new dirent containing the data of the file
-    struct inode* rootdir = iget(ROOTDEV, ROOTINO);
-
-    int rootpos = findemptydirentoffset();
-    if(rootpos == -1) {
-      irelease(rootdir);
-      //releasesleep(&icache.openlock);
-      return NULL;
-    }
+  // The file does not already exist
+  if(O_CREATE != (O_CREATE & mode))
+    return NULL;
 
-    concurrent_writei(rootdir, (char*) &entry, rootpos, sizeof(struct dirent));
+  if ((dir = nameiparent(path, name)) == NULL)
+    return NULL;
+  locki(dir);
 
-    irelease(rootdir);
+  // The directory may have been removed since our lookup
+  if (dir->type != T_DIR) {
+    unlocki(dir);
+    irelease(dir);
+    return NULL;
+  }
 
-    // Acquire/create the inode we will be using for this file 
-    struct inode* returner = iget(ROOTDEV,  inodepos / sizeof(struct dinode));
-    
+  // Someone else may have created the file since our lookup
+  if ((inode = dirlookup(dir, name, 0)) != NULL) {
+    unlocki(dir);
+    irelease(dir);
+    locki(inode);
+    unlocki(inode);
+    return inode;
+  }
 
-    releasesleep(&icache.openlock);
+  // Construct a struct dinode called din
+  struct dinode di;
+  // Update the din with the correct information.
+  // Type will always be that of file, size will be that of 0,
+  // the devid will be the DEVROOT constant (since we only have 1 drive),
+  // data will not be modified since it starts empty, and
+  // pad will likewise not be modified.
+  memset(&di, 0, sizeof(di));
+  di.type = T_FILE;
+  di.devid = ROOTDEV;
+  di.size = 0;
+  // New files start out with their data inline in the dinode
+  di.flags = DI_INLINE;
+
+  // Take a free inum from the inode bitmap and write our dinode there
+  int inum = ialloc(&di);
+  if(inum == -1) {
+    unlocki(dir);
+    irelease(dir);
+    return NULL;  
+  }
 
-    return returner;
+  // Add a dirent for the new file to its directory
+  if(dirlink(dir, name, inum) == -1) {
+    unlocki(dir);
+    irelease(dir);
+    di.type = -1;
+    write_dinode(inum, &di);
+    ifree(inum);
+    return NULL;
   }
+  unlocki(dir);
+  irelease(dir);
 
-  releasesleep(&icache.openlock);
-  return inode;
+  // Acquire/create the inode we will be using for this file 
+  return iget(ROOTDEV, inum);
 }
 
 
-static int 
-findemptyinodeoffset(struct dinode* di) {
-   
-  locki(&icache.inodefile);
-  struct dinode node;
-  int offset = 0;
+static int ialloc(struct dinode* di) {
+  uint inum;
 
-  // Iterate through every data field
-  for(int i = 0; i < 30; i++) {
-    
-    // Ran out of space in the inode, allocate space onto the end of the file and put thing there
-    if(icache.inodefile.data[i].nblocks == 0) {
+  // Hold the inodefile lock across allocation and the dinode write so that
+  // appends to the end of the inodefile happen in inum order.
+  locki(&icache.inodefile);
+  acquire(&imap.lock);
 
-      unlocki(&icache.inodefile);
-      return icache.inodefile.size;     
+  // Skip over fully used bytes of the bitmap, starting from the hint
+  for (inum = imap.hint; inum < imap.ninodes; inum++) {
+    if (inum % 8 == 0 && imap.map[inum / 8] == 0xff) {
+      inum += 7;
+      continue;
     }
+    if ((imap.map[inum / 8] & (1 << (inum % 8))) == 0)
+      break;
+  }
 
-    // For each extent's blocks
-    for(int j = 0; j < icache.inodefile.data[i].nblocks; j++) {
-      
-      
-       // Within the given inodes device, begin reading at the extent the
-        // offset specifies
-        struct buf* bp = bread(icache.inodefile.dev, icache.inodefile.data[i].startblkno + j);
-
-        for(int k = 0; k < BSIZE; k += sizeof(node)) {
-          
-          
-          memmove(&node, bp->data + k, sizeof(node));
-          if(node.type == -1) {
-          
-            brelse(bp);
-            unlocki(&icache.inodefile);
-            return offset;
-            
-          }
-
-          offset += sizeof(node);
-        }
-
-        brelse(bp);
+  if (inum >= imap.ninodes) {
+    // No free slot inside the inodefile, so append a new dinode to it
+    inum = imap.ninodes;
+    if (inum >= NDINODE) {
+      release(&imap.lock);
+      unlocki(&icache.inodefile);
+      return -1;
     }
+    imap.ninodes++;
+  }
+  imap.map[inum / 8] |= 1 << (inum % 8);
+  imap.hint = inum + 1;
+  release(&imap.lock);
+
+  if (writei(&icache.inodefile, (char *)di, INODEOFF(inum), sizeof(*di)) != sizeof(*di)) {
+    acquire(&imap.lock);
+    if (inum == imap.ninodes - 1 && INODEOFF(inum) >= icache.inodefile.size)
+      imap.ninodes--;
+    release(&imap.lock);
+    ifree(inum);
+    unlocki(&icache.inodefile);
+    return -1;
   }
 
-  // We already have 30 extents
   unlocki(&icache.inodefile);
-  return -1;
+  return inum;
 }
 
-static int findemptydirentoffset() {
-  struct inode* rootdir = iget(ROOTDEV, 1);
-  struct dirent entry;
-  int offset = 0;
-
-  locki(rootdir);
-
-  // Iterate through every data field
-  for(int i = 0; i < 30; i++) {
-    
-    // Ran out of space in the inode, allocate space onto the end of the file and put thing there
-    if(icache.inodefile.data[i].nblocks == 0) {
-      unlocki(rootdir);
-      irelease(rootdir);
-      return rootdir->size;     
-    }
-
-    // For each extent's blocks
-    for(int j = 0; j < rootdir->data[i].nblocks; j++) {
-      
-      
-       // Within the given inodes device, begin reading at the extent the
-        // offset specifies
-        struct buf* bp = bread(rootdir->dev, rootdir->data[i].startblkno + j);
-
-        for(int k = 0; k < BSIZE; k += sizeof(entry)) {
-          
-          memmove(&entry, bp->data + k, sizeof(entry));
-          if(entry.inum == 0) {
-          
-            brelse(bp);
-            unlocki(rootdir);
-            irelease(rootdir);
-            return offset;
-            
-          }
-
-          offset += sizeof(entry);
-        }
-
-        brelse(bp);
-    }
-  }
-  unlocki(rootdir);
-  irelease(rootdir);
-
-  // We already have 30 extents
-  return -1;
+static void ifree(uint inum) {
+  acquire(&imap.lock);
+  imap.map[inum / 8] &= ~(1 << (inum % 8));
+  if (inum < imap.hint)
+    imap.hint = inum;
+  release(&imap.lock);
 }
 
 // Increment reference count for ip.
@@ -472,13 +751,17 @@ struct inode *idup(struct inode *ip) {
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode stays cached
+// (and valid) on the LRU list until iget recycles it.
 void irelease(struct inode *ip) {
   acquire(&icache.lock);
-  // inode has no other references release
-  if (ip->ref == 1)
-    ip->type = 0;
+  // inode has no other references, make it the most recently used
+  if (ip->ref == 1) {
+    ip->next = icache.lru.next;
+    ip->prev = &icache.lru;
+    icache.lru.next->prev = ip;
+    icache.lru.next = ip;
+  }
   ip->ref--;
   release(&icache.lock);
 }
@@ -506,6 +789,7 @@ void locki(struct inode *ip) {
 
     ip->size = dip.size; 
     memmove(ip->data, &dip.data, 30 * sizeof(struct extent));
+    ip->flags = dip.flags;
     ip->valid = 1;
 
     if (ip->type == 0) {
@@ -515,90 +799,187 @@ void locki(struct inode *ip) {
 }
 
 int unlink(char* path) {
+  char name[DIRSIZ];
+  struct inode* dir;
+  struct inode* node;
+  uint off;
 
+  // Acquire the directory holding the file
+  if((dir = nameiparent(path, name)) == NULL)
+    return -1;
+  locki(dir);
 
-  // Acquire the root directory
-  struct inode* rootdir = iget(ROOTDEV, 1);
+  // A directory's own entries are never removed
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0) {
+    unlocki(dir);
+    irelease(dir);
+    return -1;
+  }
 
-  // Acquire the offset and the inode of the file in the root directory
+  // Acquire the offset and the inode of the file in the directory
   // if it exists
-  uint off;
-  struct inode* node;
-  locki(rootdir);
-  node = dirlookup(rootdir, path, &off);
-  unlocki(rootdir);
-  
-  if(node == NULL) {
-    irelease(rootdir);
+  if((node = dirlookup(dir, name, &off)) == NULL) {
+    unlocki(dir);
+    irelease(dir);
     return -1;
   }
-  
+
+  // The file is still open somewhere
   if(node->ref != 1) {
-    irelease(rootdir);
     irelease(node);
+    unlocki(dir);
+    irelease(dir);
     return -1;
   }
 
-  // Check that the path represents a directory or a device, and if so return -1
-  if(node->type == T_DEV || node->type == T_DIR) {
+  // Devices and directories that still hold entries cannot be removed
+  locki(node);
+  if(node->type == T_DEV || (node->type == T_DIR && !isdirempty(node))) {
+    unlocki(node);
     irelease(node);
-    irelease(rootdir);
+    unlocki(dir);
+    irelease(dir);
     return -1;
   }
 
-  // Free extents of the file
-  //locki(node);
-  for(int i = 0; i < 30; i++) {
-    if(node->data[i].nblocks != 0) {
-      bfree(ROOTDEV, node->data[i].startblkno, node->data[i].nblocks);
-    }
+  // Remove the file's dirent from the directory first, so no new lookup
+  // can find the inum once it is freed. The directory keeps its size; the
+  // slot is reused by the next create.
+  if(dirunlink(dir, name, off) == -1) {
+    unlocki(node);
+    irelease(node);
+    unlocki(dir);
+    irelease(dir);
+    return -1;
   }
-  //unlocki(node);
 
+  // Free extents of the file
+  itrunc(node);
+
+  // Forget the names looked up in a removed directory, since its inum
+  // may be reused by another directory
+  if(node->type == T_DIR) {
+    dcachepurge(node->dev, node->inum);
+    dindex_drop(node);
+  }
 
-  // Remove the inode from the inodefile;
-  // Acquire the inode’s dinode so that we can free it
+  // Remove the inode from the inodefile by marking its dinode free
+  // and returning the inum to the free-inode bitmap
   struct dinode di; 
+  memset(&di, 0, sizeof(di));
   di.type = -1;
-  // Set the inode's dinode to be a size of -1
   write_dinode(node->inum, &di);
-   
-  // Remove the file's dirent from the root directory
+  ifree(node->inum);
 
-  struct dirent entry;
-  entry.inum = 0;
-  if(concurrent_writei(rootdir, (char*) &entry, off, sizeof(entry)) == -1)
-    return -1;
+  // The cached copy no longer describes an on-disk inode
+  node->valid = 0;
+  unlocki(node);
 
-  // update rootdir's size in its dinode
-  struct inode* rootinode = iget(ROOTDEV, ROOTINO);
-  struct dinode rootnode;
+  // Decrement reference count back to 0 (it gets set to 1 by dirlookup)
+  irelease(node);
+  unlocki(dir);
+  irelease(dir);
 
-  rootnode.size = rootinode->size - sizeof(struct dirent);
-  memmove(rootnode.data, rootinode->data, 30 * sizeof(struct extent));
-  rootnode.devid = rootinode->devid;
-  rootnode.type = rootinode->type;
+  // Return success
+  return 0;
+}
 
-  write_dinode(rootdir->inum, &rootnode);
+static bool isdirempty(struct inode *dp) {
+  struct dirent de;
+  uint off;
 
-  // update the inodefile's size in its dinode;
-  
-  
-  struct dinode inodefilenode;
+  for (off = 0; off < dp->size; off += sizeof(de)) {
+    if (readi(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
+      panic("isdirempty read");
+    if (de.inum != 0 && namecmp(de.name, ".") != 0 &&
+        namecmp(de.name, "..") != 0)
+      return false;
+  }
+  return true;
+}
 
-  inodefilenode.size = icache.inodefile.size - sizeof(struct dirent);
-  memmove(inodefilenode.data, icache.inodefile.data, 30 * sizeof(struct extent));
-  inodefilenode.devid = icache.inodefile.devid;
-  inodefilenode.type = icache.inodefile.type;
+// Create an empty directory at path, holding only "." and "..". Like a
+// create in iopen, only the parent directory is locked, so directories
+// are made in different parents in parallel. Returns 0 on success, -1 if
+// the path exists, its parent is not a directory, or the disk is full.
+int mkdir(char *path) {
+  char name[DIRSIZ];
+  struct inode *dir, *ip;
+  struct dinode di;
+  int inum;
 
-  write_dinode(0, &inodefilenode);
+  if ((dir = nameiparent(path, name)) == NULL)
+    return -1;
+  locki(dir);
+
+  // The parent may have been removed since our lookup
+  ip = NULL;
+  if (dir->type != T_DIR || (ip = dirlookup(dir, name, 0)) != NULL) {
+    if (ip)
+      irelease(ip);
+    unlocki(dir);
+    irelease(dir);
+    return -1;
+  }
 
-  
-  // Decrement reference count back to 0 (it gets set to 1 by dirlookup)
-  irelease(node);
-  irelease(rootdir);
+  // Like new files, new directories keep their entries inline until
+  // they outgrow the dinode
+  memset(&di, 0, sizeof(di));
+  di.type = T_DIR;
+  di.devid = ROOTDEV;
+  di.flags = DI_INLINE;
+  if ((inum = ialloc(&di)) == -1) {
+    unlocki(dir);
+    irelease(dir);
+    return -1;
+  }
 
-  // Return success
+  // No one else can find the new directory until it is linked into dir
+  ip = iget(dir->dev, inum);
+  locki(ip);
+  if (dirlink(ip, ".", inum) == -1 || dirlink(ip, "..", dir->inum) == -1 ||
+      dirlink(dir, name, inum) == -1) {
+    itrunc(ip);
+    dcachepurge(ip->dev, ip->inum);
+    dindex_drop(ip);
+    memset(&di, 0, sizeof(di));
+    di.type = -1;
+    write_dinode(inum, &di);
+    ifree(inum);
+    ip->valid = 0;
+    unlocki(ip);
+    irelease(ip);
+    unlocki(dir);
+    irelease(dir);
+    return -1;
+  }
+  unlocki(ip);
+  irelease(ip);
+  unlocki(dir);
+  irelease(dir);
+  return 0;
+}
+
+// Make the directory at path the current directory of this process,
+// which relative paths are looked up from. Returns -1 if path is not a
+// directory.
+int chdir(char *path) {
+  struct proc *p = myproc();
+  struct inode *ip;
+
+  if ((ip = namei(path)) == NULL)
+    return -1;
+  locki(ip);
+  if (ip->type != T_DIR) {
+    unlocki(ip);
+    irelease(ip);
+    return -1;
+  }
+  unlocki(ip);
+
+  if (p->cwd)
+    irelease(p->cwd);
+  p->cwd = ip;
   return 0;
 }
 
@@ -640,11 +1021,63 @@ int concurrent_readi(struct inode *ip, char *dst, uint off, uint n) {
   return retval;
 }
 
+// threadsafe readi into the current process's user buffer dst, for files
+// opened with O_DIRECT. Whole blocks go from the disk straight into the
+// user's pages without passing through (or evicting anything from) the
+// buffer cache; partial blocks at either end are read through the cache.
+int concurrent_readi_direct(struct inode *ip, char *dst, uint off, uint n) {
+  int retval;
+
+  locki(ip);
+  retval = readi_common(ip, dst, off, n, true);
+  unlocki(ip);
+
+  return retval;
+}
+
+// threadsafe readi into each of the cnt buffers of iov in turn, starting
+// at off, under one acquisition of the inode lock. Stops early at the end
+// of the file. Returns the number of bytes read, or -1 if none could be.
+int concurrent_readvi(struct inode *ip, struct iovec *iov, int cnt, uint off,
+                      bool direct) {
+  int i, n, tot;
+
+  locki(ip);
+  for (i = 0, tot = 0; i < cnt; i++) {
+    if (iov[i].iov_len == 0)
+      continue;
+    if (ip->type != T_DEV && off >= ip->size)
+      break;
+    if ((n = readi_common(ip, iov[i].iov_base, off, iov[i].iov_len,
+                          direct)) < 0) {
+      if (tot == 0)
+        tot = -1;
+      break;
+    }
+    tot += n;
+    off += n;
+    if (n < iov[i].iov_len)
+      break;
+  }
+  unlocki(ip);
+
+  return tot;
+}
+
 // Read data from inode.
 // Returns number of bytes read.
 // Caller must hold ip->lock.
 int readi(struct inode *ip, char *dst, uint off, uint n) {
-  
+  return readi_common(ip, dst, off, n, false);
+}
+
+static int readi_common(struct inode *ip, char *dst, uint off, uint n,
+                        bool direct) {
+  struct pcpage *pg;
+  struct buf *bp;
+  uint tot, m, b;
+  char *ka;
+
   // Acquires the sleeplock
   if (!holdingsleep(&ip->lock))
     panic("not holding lock");
@@ -666,14 +1099,61 @@ int readi(struct inode *ip, char *dst, uint off, uint n) {
   if (off + n > ip->size)
     n = ip->size - off;
 
-  int val = readfromextent(ip, dst, off, n);
-  if(val == -1) {
-    return -1;
+  // Small files keep their bytes in the inode itself
+  if (ip->flags & DI_INLINE) {
+    memmove(dst, (char *)ip->data + off, n);
+    return n;
+  }
+
+  if (ipcached(ip) && !direct) {
+    for (tot = 0; tot < n; tot += m, off += m, dst += m) {
+      pg = pcget(ip, off / PGSIZE);
+      m = min(n - tot, PGSIZE - off % PGSIZE);
+      memmove(dst, pg->data + off % PGSIZE, m);
+      pcput(pg);
+    }
+    return n;
+  }
+
+  for (tot = 0; tot < n; tot += m, off += m, dst += m) {
+    m = min(n - tot, bsize - off % bsize);
+    // Holes read as zeros
+    if ((b = emap(ip, off / bsize)) == 0) {
+      memset(dst, 0, m);
+      continue;
+    }
+    if (direct && m == bsize &&
+        (ka = uva2ka(&myproc()->vspace, (uint64_t)dst, bsize))) {
+      breaddirect(ip->dev, b, (uchar *)ka);
+      continue;
+    }
+    bp = bread(ip->dev, b);
+    memmove(dst, bp->data + off % bsize, m);
+    brelse(bp);
   }
 
   return n;
 }
 
+// Returns the page cache frame holding page pgno of ip with a reference
+// taken for the caller, who maps it read-only (or copy-on-write) into a
+// process and drops the reference with kfree. Returns 0 if ip's data is not
+// kept in the page cache. Caller must hold ip->lock.
+char *imappage(struct inode *ip, uint pgno) {
+  struct pcpage *pg;
+  char *frame;
+
+  if (!holdingsleep(&ip->lock))
+    panic("not holding lock");
+  if (!ipcached(ip) || (ip->flags & DI_INLINE))
+    return 0;
+
+  pg = pcget(ip, pgno);
+  frame = pcmap(pg);
+  pcput(pg);
+  return frame;
+}
+
 // threadsafe writei.
 int concurrent_writei(struct inode *ip, char *src, uint off, uint n) {
   int retval;
@@ -686,10 +1166,41 @@ int concurrent_writei(struct inode *ip, char *src, uint off, uint n) {
 }
 
 
+// threadsafe writei of each of the cnt buffers of iov in turn, starting at
+// off, under one acquisition of the inode lock. Returns the number of
+// bytes written, or -1 if none could be.
+int concurrent_writevi(struct inode *ip, struct iovec *iov, int cnt,
+                       uint off) {
+  int i, n, tot;
+
+  locki(ip);
+  for (i = 0, tot = 0; i < cnt; i++) {
+    if (iov[i].iov_len == 0)
+      continue;
+    if ((n = writei(ip, iov[i].iov_base, off, iov[i].iov_len)) < 0) {
+      if (tot == 0)
+        tot = -1;
+      break;
+    }
+    tot += n;
+    off += n;
+    if (n < iov[i].iov_len)
+      break;
+  }
+  unlocki(ip);
+
+  return tot;
+}
+
 // Write data to inode.
 // Returns number of bytes written.
 // Caller must hold ip->lock.
 int writei(struct inode *ip, char *src, uint off, uint n) {
+  struct pcpage *pg;
+  struct buf *bp;
+  uint tot, m, b;
+  int grew;
+
   if (!holdingsleep(&ip->lock))
     panic("not holding lock");
 
@@ -700,222 +1211,1624 @@ int writei(struct inode *ip, char *src, uint off, uint n) {
   }
 
 
-  if(n <= 0) {
+  if(n <= 0 || off + n < off) {
     return -1;
   }
 
-  // The index denoting which extent we are on
-  int blocknum = writetoextent(ip, src, off, n);
-  if(blocknum == -1) {
+  if (ip->flags & DI_INLINE) {
+    // Still fits in the inode: the data goes out with the dinode
+    if (off + n <= INLINESIZE) {
+      if (off > ip->size)
+        memset((char *)ip->data + ip->size, 0, off - ip->size);
+      memmove((char *)ip->data + off, src, n);
+      if (off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+
+    // Grown past the inline area, move the data out to extents
+    if (inlinetoextent(ip) == -1)
+      return -1;
+  }
+
+  // Map every block the write touches. Any gap between the end of the file
+  // and off is left as a hole. New blocks the write covers only in part
+  // are zeroed, so the rest of them can't show what the disk held.
+  grew = imapblocks(ip, off / bsize, (off + n + bsize - 1) / bsize,
+                    (off + bsize - 1) / bsize, (off + n) / bsize);
+  if (grew == -1)
     return -1;
+  if ((ip->flags & DI_SHARED) && iunshare(ip, off, n) == -1)
+    return -1;
+
+  for (tot = 0; tot < n; tot += m, off += m, src += m) {
+    if (ipcached(ip)) {
+      pg = pcget(ip, off / PGSIZE);
+      m = min(n - tot, PGSIZE - off % PGSIZE);
+      memmove(pg->data + off % PGSIZE, src, m);
+      pcwrite(ip, pg, off % PGSIZE, m);
+      pcput(pg);
+      continue;
+    }
+    b = emap(ip, off / bsize);
+    bp = bread(ip->dev, b);
+    m = min(n - tot, bsize - off % bsize);
+    memmove(bp->data + off % bsize, src, m);
+    bwrite(bp);
+    brelse(bp);
   }
 
   // increase the size of the file
-  if(off + n > ip->size) {
-    ip->size += ((off + n) - ip->size); 
-    struct dinode di;
-    memmove(di.data, ip->data, 30 * sizeof(struct extent));
-    di.devid = ip->devid;
-    di.size = ip->size;
-    di.type = ip->type;
-    write_dinode(ip->inum, &di);
+  if (grew > 0 || off > ip->size) {
+    if (off > ip->size)
+      ip->size = off;
+    iupdate(ip);
   }
 
   return n;
 }
 
-static int 
-writetoextent(struct inode* node, char* src, int off, int n) {
-  
-  bool writing = false;
-  int totalsize = 0;
-  int totalwritten = 0;
-  
+// Move the inline data of ip out to newly allocated blocks and clear
+// DI_INLINE. Returns -1 if no blocks could be allocated.
+static int inlinetoextent(struct inode *ip) {
+  char buf[INLINESIZE];
+  uint size = ip->size;
 
-  // Iterate through every data field
-  for(int i = 0; i < 30; i++) {
-    
-    // If an extent doesn't already exist here, then we make one and have
-    // it be big to extend the file enough to reach the offset
-    if(node->data[i].nblocks == 0) {
-    
-      // Calculate number of blocks we need
-      int blocks;
-      if(n % BSIZE == 0) {
-        blocks = n / BSIZE;
-      } else {
-        blocks = n / BSIZE + 1;
+  memmove(buf, ip->data, size);
+  memset(ip->data, 0, sizeof(ip->data));
+  ip->flags &= ~DI_INLINE;
+  if (size == 0)
+    return 0;
+
+  ip->size = 0;
+  if (writei(ip, buf, 0, size) != size) {
+    // Out of space: go back to the inline copy
+    memmove(ip->data, buf, size);
+    ip->size = size;
+    ip->flags |= DI_INLINE;
+    return -1;
+  }
+  return 0;
+}
+
+// Block reference counts.
+//
+// clone_file lets files share disk blocks. The refcount file (inum
+// REFCNTINO) holds a ushort for each disk block: the number of references
+// to the block beyond the first. Blocks no clone shares count 0, so the
+// file is a hole except around shared blocks. Only files with DI_SHARED
+// set consult it, when they free blocks or write to them (see iunshare).
+// rcbuf and the counts are protected by the refcount inode's lock, which
+// is taken after the lock of the file whose blocks are counted. No bitmap
+// block may be held while taking it: clone_file allocates blocks for the
+// refcount file under it (see rcinc).
+
+static ushort rcbuf[MAXBSIZE / sizeof(ushort)];
+
+// Largest count a ushort holds
+#define RCMAX 0xffff
+
+// Blocks rcdrop collects to free before it releases the refcount lock
+#define NRCRUN 8
+
+// Read the segment of the refcount file holding the count of block
+// seg * (bsize / sizeof(ushort)) into rcbuf. Caller must hold the refcount
+// inode's lock.
+static void rcread(uint seg) {
+  struct inode *rp = icache.refcnt;
+
+  memset(rcbuf, 0, bsize);
+  if (seg * bsize < rp->size)
+    readi(rp, (char *)rcbuf, seg * bsize, bsize);
+}
+
+// Take one more reference on each of the n disk blocks from b. Returns -1,
+// changing no count, if a count is already at RCMAX or the refcount file
+// can't grow.
+static int rcinc(uint b, uint n) {
+  struct inode *rp = icache.refcnt;
+  uint per, seg, lo, hi, i, c, m;
+  int r;
+
+  per = bsize / sizeof(ushort);
+  r = 0;
+  locki(rp);
+  // Check every count before changing any
+  for (c = b, m = n; m > 0; c += hi - lo, m -= hi - lo) {
+    seg = c / per;
+    lo = c % per;
+    hi = min(per, lo + m);
+    rcread(seg);
+    for (i = lo; i < hi; i++)
+      if (rcbuf[i] == RCMAX)
+        r = -1;
+  }
+  for (c = b, m = n; r == 0 && m > 0; c += hi - lo, m -= hi - lo) {
+    seg = c / per;
+    lo = c % per;
+    hi = min(per, lo + m);
+    rcread(seg);
+    for (i = lo; i < hi; i++)
+      rcbuf[i]++;
+    // Undo the segments written so far if the file can't grow
+    if (writei(rp, (char *)rcbuf, seg * bsize, bsize) != bsize) {
+      r = -1;
+      for (m = c - b, c = b; m > 0; c += hi - lo, m -= hi - lo) {
+        seg = c / per;
+        lo = c % per;
+        hi = min(per, lo + m);
+        rcread(seg);
+        for (i = lo; i < hi; i++)
+          rcbuf[i]--;
+        writei(rp, (char *)rcbuf, seg * bsize, bsize);
       }
+    }
+  }
+  unlocki(rp);
+  return r;
+}
 
-      // Allocate new space
-      node->data[i].startblkno = balloc(node->dev, blocks);
-      node->data[i].nblocks = blocks;
-      
-      // Reset the offset we are at in the blocks to the new position
-      off -= totalsize;
-      totalsize = 0;
+// Drop a reference to each of the n disk blocks from b, freeing through fb
+// the blocks whose count was 0. The blocks are freed after the refcount
+// lock is released, and fb's bitmap block is written out before taking
+// it, so no bitmap block is held while waiting for the refcount lock.
+static void rcdrop(uint b, uint n, struct bfreebatch *fb) {
+  struct inode *rp = icache.refcnt;
+  struct extent run[NRCRUN];
+  uint per, seg, lo, hi, i, blk;
+  int nrun, j;
+  bool dirty;
+
+  per = bsize / sizeof(ushort);
+  while (n > 0) {
+    seg = b / per;
+    lo = b % per;
+    hi = min(per, lo + n);
+
+    bfreeflush(fb);
+    locki(rp);
+    rcread(seg);
+    dirty = false;
+    nrun = 0;
+    for (i = lo; i < hi; i++) {
+      if (rcbuf[i] != 0) {
+        rcbuf[i]--;
+        dirty = true;
+        continue;
+      }
+      blk = seg * per + i;
+      if (nrun > 0 && run[nrun - 1].startblkno + run[nrun - 1].nblocks == blk) {
+        run[nrun - 1].nblocks++;
+        continue;
+      }
+      // Out of room: free what was collected, then carry on from blk
+      if (nrun == NRCRUN)
+        break;
+      run[nrun].startblkno = blk;
+      run[nrun].nblocks = 1;
+      nrun++;
     }
-    
-    // Skip this extents blocks
-    if(off > totalsize + (node->data[i].nblocks * BSIZE)){
-      totalsize += node->data[i].nblocks * BSIZE;
-      continue;
+    // A count that was dropped was not 0, so its block of the refcount
+    // file is already allocated
+    if (dirty)
+      writei(rp, (char *)rcbuf, seg * bsize, bsize);
+    unlocki(rp);
+
+    for (j = 0; j < nrun; j++)
+      bfreerun(fb, run[j].startblkno, run[j].nblocks);
+    b += i - lo;
+    n -= i - lo;
+  }
+}
+
+// The reference count of disk block b.
+static uint rcget(uint b) {
+  struct inode *rp = icache.refcnt;
+  ushort cnt;
+
+  cnt = 0;
+  locki(rp);
+  if (b * sizeof(ushort) < rp->size)
+    readi(rp, (char *)&cnt, b * sizeof(ushort), sizeof(ushort));
+  unlocki(rp);
+  return cnt;
+}
+
+// Free the n data blocks of ip from b through fb, or just drop ip's
+// references to them if they may be shared.
+static void bfreedata(struct inode *ip, struct bfreebatch *fb, uint b,
+                      uint n) {
+  if (ip->flags & DI_SHARED)
+    rcdrop(b, n, fb);
+  else
+    bfreerun(fb, b, n);
+}
+
+// Extent trees.
+//
+// A file's blocks are first mapped by the flat list of up to 30 extents in
+// the dinode, which cover the file's blocks in order. When a 31st extent is
+// needed, or the file gets a hole, the file switches to an extent tree
+// (DI_ETREE, see extent.h) whose root is the dinode's data area. A lookup
+// binary searches one node per level, so it reads O(log n) blocks.
+//
+// Holes are the file blocks no tree entry covers: they take no disk blocks
+// and read as zeros. Appending fills nodes along the rightmost path of the
+// tree; filling a hole inserts in the middle and splits full nodes in half.
+// Truncation (etrunc) cuts the tree back from the right.
+
+// Entries in the root (in the dinode) and in a node block
+#define NROOTENT \
+  ((30 * sizeof(struct extent) - sizeof(struct extent_header)) / \
+   sizeof(struct extent_entry))
+#define NBLKENT \
+  ((bsize - sizeof(struct extent_header)) / sizeof(struct extent_entry))
+
+static struct extent_header *eroot(struct inode *ip) {
+  return (struct extent_header *)ip->data;
+}
+
+static struct extent_entry *eentries(struct extent_header *h) {
+  return (struct extent_entry *)(h + 1);
+}
+
+// Index of the last entry of node h that starts at or before fbn, or -1.
+static int esearch(struct extent_header *h, uint fbn) {
+  struct extent_entry *e = eentries(h);
+  int lo, hi, mid, found;
+
+  found = -1;
+  lo = 0;
+  hi = h->nentries - 1;
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if (e[mid].fbn <= fbn) {
+      found = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
     }
+  }
+  return found;
+}
 
-    int blocksdeep = 0;
-    blocksdeep = (off - totalsize) / BSIZE;
-    totalsize += (blocksdeep * BSIZE);
+// Find the extent of ip covering file block fbn and copy it to *ext, with
+// ext->fbn set for flat extents too. Returns -1 if fbn is in a hole or past
+// the last extent.
+static int efind(struct inode *ip, uint fbn, struct extent_entry *ext) {
+  struct extent_header *h;
+  struct extent_entry *e;
+  struct buf *bp;
+  uint f, child;
+  int i, r;
+
+  if (!(ip->flags & DI_ETREE)) {
+    for (f = 0, i = 0; i < 30 && ip->data[i].nblocks != 0; i++) {
+      if (fbn < f + ip->data[i].nblocks) {
+        ext->fbn = f;
+        ext->startblkno = ip->data[i].startblkno;
+        ext->nblocks = ip->data[i].nblocks;
+        return 0;
+      }
+      f += ip->data[i].nblocks;
+    }
+    return -1;
+  }
+
+  bp = 0;
+  h = eroot(ip);
+  for (;;) {
+    if ((i = esearch(h, fbn)) < 0) {
+      r = -1;
+      break;
+    }
+    e = &eentries(h)[i];
+    if (h->depth == 0) {
+      r = fbn - e->fbn < e->nblocks ? 0 : -1;
+      *ext = *e;
+      break;
+    }
+    child = e->startblkno;
+    if (bp)
+      brelse(bp);
+    bp = bread(ip->dev, child);
+    h = (struct extent_header *)bp->data;
+  }
+  if (bp)
+    brelse(bp);
+  return r;
+}
+
+// Return the disk block holding file block fbn of ip, or 0 if the file
+// has no block there. Caller must hold ip->lock.
+uint emap(struct inode *ip, uint fbn) {
+  struct extent_entry e;
+
+  if (efind(ip, fbn, &e) == -1)
+    return 0;
+  return e.startblkno + (fbn - e.fbn);
+}
 
-    // For each extent's blocks
-    for(int j = blocksdeep; j < node->data[i].nblocks; j++) {
-      
-      // Acknowledge we visited this block
-      totalsize += BSIZE;
+// Call fn on each entry of the subtree at node h in file block order, with
+// leaf set for leaf entries. A node is visited after its children.
+static void ewalk(struct inode *ip, struct extent_header *h,
+                  void (*fn)(void *, struct extent_entry *, bool), void *arg) {
+  struct extent_entry *e = eentries(h);
+  struct buf *bp;
+  int i;
+
+  for (i = 0; i < h->nentries; i++) {
+    if (h->depth > 0) {
+      bp = bread(ip->dev, e[i].startblkno);
+      ewalk(ip, (struct extent_header *)bp->data, fn, arg);
+      brelse(bp);
+    }
+    fn(arg, &e[i], h->depth == 0);
+  }
+}
+
+// Call fn on each extent of ip, and on each tree node.
+// Caller must hold ip->lock.
+static void eforeach(struct inode *ip,
+                     void (*fn)(void *, struct extent_entry *, bool),
+                     void *arg) {
+  struct extent_entry e;
+  int i;
+
+  if (ip->flags & DI_ETREE) {
+    ewalk(ip, eroot(ip), fn, arg);
+    return;
+  }
+  for (e.fbn = 0, i = 0; i < 30 && ip->data[i].nblocks != 0; i++) {
+    e.startblkno = ip->data[i].startblkno;
+    e.nblocks = ip->data[i].nblocks;
+    fn(arg, &e, true);
+    e.fbn += e.nblocks;
+  }
+}
 
-      // We've reached the block the offset is in, so now we start
-      // writing n data
-      if(totalsize > off) {
-        writing = true;
+// Number of file blocks up to the end of the last extent of ip, holes
+// included. Sets *end to the disk block just past its last extent (0 if it
+// has none).
+static uint emapped(struct inode *ip, uint *end) {
+  struct extent_header *h;
+  struct extent_entry *e;
+  struct buf *bp;
+  uint n, child;
+  int i;
+
+  *end = 0;
+  if (!(ip->flags & DI_ETREE)) {
+    for (n = 0, i = 0; i < 30 && ip->data[i].nblocks != 0; i++) {
+      n += ip->data[i].nblocks;
+      *end = ip->data[i].startblkno + ip->data[i].nblocks;
+    }
+    return n;
+  }
+
+  // Follow the rightmost path down to the last leaf entry
+  bp = 0;
+  h = eroot(ip);
+  if (h->nentries == 0)
+    return 0;
+  while (h->depth > 0) {
+    child = eentries(h)[h->nentries - 1].startblkno;
+    if (bp)
+      brelse(bp);
+    bp = bread(ip->dev, child);
+    h = (struct extent_header *)bp->data;
+  }
+  e = &eentries(h)[h->nentries - 1];
+  n = e->fbn + e->nblocks;
+  *end = e->startblkno + e->nblocks;
+  if (bp)
+    brelse(bp);
+  return n;
+}
+
+// Free the blocks of the subtree at node h, along with its node blocks.
+static void efree(struct inode *ip, struct extent_header *h,
+                  struct bfreebatch *fb) {
+  struct extent_entry *e = eentries(h);
+  struct buf *bp;
+  int i;
+
+  for (i = 0; i < h->nentries; i++) {
+    if (h->depth == 0) {
+      bfreedata(ip, fb, e[i].startblkno, e[i].nblocks);
+    } else {
+      bp = bread(ip->dev, e[i].startblkno);
+      efree(ip, (struct extent_header *)bp->data, fb);
+      brelse(bp);
+      bfreerun(fb, e[i].startblkno, 1);
+    }
+  }
+}
+
+// Drop every file block from keep on out of the subtree at node h, freeing
+// whole extents and subtrees past keep and the tail of the extent that
+// straddles it. Children left empty are freed too.
+static void etrunc(struct inode *ip, struct extent_header *h, uint keep,
+                   struct bfreebatch *fb) {
+  struct extent_header *ch;
+  struct extent_entry *e;
+  struct buf *bp;
+
+  while (h->nentries > 0) {
+    e = &eentries(h)[h->nentries - 1];
+    if (h->depth == 0) {
+      if (e->fbn >= keep) {
+        bfreedata(ip, fb, e->startblkno, e->nblocks);
+        h->nentries--;
+        continue;
+      }
+      if (e->fbn + e->nblocks > keep) {
+        bfreedata(ip, fb, e->startblkno + (keep - e->fbn),
+                  e->fbn + e->nblocks - keep);
+        e->nblocks = keep - e->fbn;
       }
+      return;
+    }
 
-      // Write data to the current block
-      if(writing) {
-        
-        // Within the given inodes device, begin reading at the extent the
-        // offset specifies
-        struct buf* bp = bread(node->dev, node->data[i].startblkno + j);
-        
-        // Writes us to the next block
-        int m = min(n, BSIZE - (off % BSIZE));
-
-        // move where we are at in a given block
-        // we are writing to
-        memset(bp->data + off % BSIZE, 0, m);
-        memmove(bp->data + off % BSIZE, src, m);
+    bp = bread(ip->dev, e->startblkno);
+    ch = (struct extent_header *)bp->data;
+    if (e->fbn < keep) {
+      etrunc(ip, ch, keep, fb);
+      if (ch->nentries > 0) {
         bwrite(bp);
         brelse(bp);
+        return;
+      }
+    }
+    efree(ip, ch, fb);
+    brelse(bp);
+    bfreerun(fb, e->startblkno, 1);
+    h->nentries--;
+  }
+}
+
+// Allocate a chain of new nodes, one per level from depth down to a leaf,
+// whose only leaf entry is *ne. Returns the block of the top node, or 0 if
+// the disk is full.
+static uint enewchain(struct inode *ip, uint depth, struct extent_entry *ne) {
+  struct extent_header *h;
+  struct extent_entry *e;
+  struct buf *bp;
+  uint b, child, got;
+
+  child = 0;
+  if (depth > 0 && (child = enewchain(ip, depth - 1, ne)) == 0)
+    return 0;
+
+  if ((b = balloc(ip->dev, 1, &got)) == 0) {
+    // Free the nodes below; the blocks of ne itself are the caller's
+    while (child != 0) {
+      bp = bread(ip->dev, child);
+      h = (struct extent_header *)bp->data;
+      b = h->depth > 0 ? eentries(h)[0].startblkno : 0;
+      brelse(bp);
+      bfree(ip->dev, child, 1);
+      child = b;
+    }
+    return 0;
+  }
 
-        // Increment offset in write's buffer
-        src += m;
+  bp = bread(ip->dev, b);
+  memset(bp->data, 0, bsize);
+  h = (struct extent_header *)bp->data;
+  e = eentries(h);
+  h->depth = depth;
+  h->nentries = 1;
+  if (depth == 0) {
+    e[0] = *ne;
+  } else {
+    e[0].fbn = ne->fbn;
+    e[0].startblkno = child;
+  }
+  bwrite(bp);
+  brelse(bp);
+  return b;
+}
 
-        // Used to determine how much we can write based on how much we have written already
-        totalwritten += m;
-        
-        // Decrement how much we have left to write from what we
-        n -= m;
+// Move the upper half of the entries of full node h into a new node, and
+// enter the new node in parent at index i + 1 (the parent has room). Returns
+// -1 if the disk is full.
+static int esplit(struct inode *ip, struct extent_header *parent, int i,
+                  struct extent_header *h) {
+  struct extent_header *nh;
+  struct extent_entry *pe;
+  struct buf *bp;
+  uint b, got, half, fbn;
+
+  if ((b = balloc(ip->dev, 1, &got)) == 0)
+    return -1;
+
+  half = h->nentries / 2;
+  fbn = eentries(h)[half].fbn;
+  bp = bread(ip->dev, b);
+  memset(bp->data, 0, bsize);
+  nh = (struct extent_header *)bp->data;
+  nh->depth = h->depth;
+  nh->nentries = h->nentries - half;
+  memmove(eentries(nh), &eentries(h)[half],
+          nh->nentries * sizeof(struct extent_entry));
+  h->nentries = half;
+  bwrite(bp);
+  brelse(bp);
+
+  pe = eentries(parent);
+  memmove(&pe[i + 2], &pe[i + 1],
+          (parent->nentries - i - 1) * sizeof(struct extent_entry));
+  pe[i + 1].fbn = fbn;
+  pe[i + 1].startblkno = b;
+  pe[i + 1].nblocks = 0;
+  parent->nentries++;
+  return 0;
+}
 
-        // Where we are at in a given block
-        off += m;
+// Insert leaf entry *ne, whose file blocks must not be mapped yet, into the
+// subtree at node h, which has room for max entries. Returns 0 on success
+// and -1 if the disk is full. If the subtree is full, returns 2 when ne
+// would go after every entry in it, or 1 otherwise.
+static int einsert(struct inode *ip, struct extent_header *h, uint max,
+                   struct extent_entry *ne) {
+  struct extent_entry *e = eentries(h);
+  struct buf *bp;
+  uint b;
+  int i, r;
+
+  // The entry ne goes in, or after. Entry fbns are lower bounds for their
+  // subtrees, so the first one can be lowered to take ne.
+  if ((i = esearch(h, ne->fbn)) < 0 && h->depth > 0) {
+    i = 0;
+    e[0].fbn = ne->fbn;
+  }
+
+  if (h->depth == 0) {
+    // Grow the extent before ne if ne follows it on disk, or the one after
+    // if ne comes just before it
+    if (i >= 0 && e[i].fbn + e[i].nblocks == ne->fbn &&
+        e[i].startblkno + e[i].nblocks == ne->startblkno) {
+      e[i].nblocks += ne->nblocks;
+      if (i + 1 < h->nentries && e[i].fbn + e[i].nblocks == e[i + 1].fbn &&
+          e[i].startblkno + e[i].nblocks == e[i + 1].startblkno) {
+        e[i].nblocks += e[i + 1].nblocks;
+        memmove(&e[i + 1], &e[i + 2],
+                (h->nentries - i - 2) * sizeof(struct extent_entry));
+        h->nentries--;
       }
+      return 0;
+    }
+    if (i + 1 < h->nentries && ne->fbn + ne->nblocks == e[i + 1].fbn &&
+        ne->startblkno + ne->nblocks == e[i + 1].startblkno) {
+      e[i + 1].fbn = ne->fbn;
+      e[i + 1].startblkno = ne->startblkno;
+      e[i + 1].nblocks += ne->nblocks;
+      return 0;
+    }
+    if (h->nentries == max)
+      return i == h->nentries - 1 ? 2 : 1;
+    memmove(&e[i + 2], &e[i + 1],
+            (h->nentries - i - 1) * sizeof(struct extent_entry));
+    e[i + 1] = *ne;
+    h->nentries++;
+    return 0;
+  }
+
+  bp = bread(ip->dev, e[i].startblkno);
+  r = einsert(ip, (struct extent_header *)bp->data, NBLKENT, ne);
+  if (r <= 0)
+    bwrite(bp);
+  if (r <= 0 || h->nentries == max) {
+    brelse(bp);
+    if (r <= 0)
+      return r;
+    return r == 2 && i == h->nentries - 1 ? 2 : 1;
+  }
+
+  if (r == 2) {
+    // Appending: start a new child after the full one, so files written
+    // sequentially fill their nodes
+    brelse(bp);
+    if ((b = enewchain(ip, h->depth - 1, ne)) == 0)
+      return -1;
+    memmove(&e[i + 2], &e[i + 1],
+            (h->nentries - i - 1) * sizeof(struct extent_entry));
+    e[i + 1].fbn = ne->fbn;
+    e[i + 1].startblkno = b;
+    e[i + 1].nblocks = 0;
+    h->nentries++;
+    return 0;
+  }
+
+  // Filling a hole: split the full child and try again
+  r = esplit(ip, h, i, (struct extent_header *)bp->data);
+  if (r == 0)
+    bwrite(bp);
+  brelse(bp);
+  if (r == -1)
+    return -1;
+  return einsert(ip, h, max, ne);
+}
+
+// Turn the flat extents of ip into an extent tree. The root goes in the
+// dinode's data area; the extents stay there too, as a leaf root, if they
+// fit, and otherwise move to a leaf block below it.
+static int etreeconvert(struct inode *ip) {
+  struct extent_entry ents[30];
+  struct extent_header *h;
+  struct buf *bp;
+  uint b, got, fbn;
+  int i, n;
+
+  for (fbn = 0, n = 0; n < 30 && ip->data[n].nblocks != 0; n++) {
+    ents[n].fbn = fbn;
+    ents[n].startblkno = ip->data[n].startblkno;
+    ents[n].nblocks = ip->data[n].nblocks;
+    fbn += ip->data[n].nblocks;
+  }
+
+  if (n <= NROOTENT) {
+    memset(ip->data, 0, sizeof(ip->data));
+    h = eroot(ip);
+    h->depth = 0;
+    h->nentries = n;
+    for (i = 0; i < n; i++)
+      eentries(h)[i] = ents[i];
+    ip->flags |= DI_ETREE;
+    return 0;
+  }
 
-      if(n == 0) {
+  if ((b = balloc(ip->dev, 1, &got)) == 0)
+    return -1;
+
+  bp = bread(ip->dev, b);
+  memset(bp->data, 0, bsize);
+  h = (struct extent_header *)bp->data;
+  h->nentries = n;
+  memmove(eentries(h), ents, n * sizeof(struct extent_entry));
+  bwrite(bp);
+  brelse(bp);
+
+  memset(ip->data, 0, sizeof(ip->data));
+  h = eroot(ip);
+  h->depth = 1;
+  h->nentries = 1;
+  eentries(h)[0].startblkno = b;
+  ip->flags |= DI_ETREE;
+  return 0;
+}
 
+// Map the nblocks disk blocks starting at startblkno as file blocks fbn on
+// of ip, which must be unmapped. The flat extents can only grow at the end;
+// a file that gets a hole switches to an extent tree.
+static int eadd(struct inode *ip, uint fbn, uint startblkno, uint nblocks) {
+  struct extent_header *h;
+  struct extent_entry ne;
+  struct buf *bp;
+  uint b, got, end;
+  int i, r;
+
+  if (!(ip->flags & DI_ETREE)) {
+    for (end = 0, i = 0; i < 30 && ip->data[i].nblocks != 0; i++)
+      end += ip->data[i].nblocks;
+    if (fbn == end) {
+      if (i > 0 && ip->data[i - 1].startblkno + ip->data[i - 1].nblocks ==
+                       startblkno) {
+        ip->data[i - 1].nblocks += nblocks;
+        return 0;
+      }
+      if (i < 30) {
+        ip->data[i].startblkno = startblkno;
+        ip->data[i].nblocks = nblocks;
         return 0;
       }
     }
-  
+    if (etreeconvert(ip) == -1)
+      return -1;
   }
 
-  // We already have 30 extents
-  return -1;
+  ne.fbn = fbn;
+  ne.startblkno = startblkno;
+  ne.nblocks = nblocks;
+
+  h = eroot(ip);
+  if ((r = einsert(ip, h, NROOTENT, &ne)) <= 0)
+    return r;
+
+  // The root is full: move it down into a new block, one level deeper
+  if ((b = balloc(ip->dev, 1, &got)) == 0)
+    return -1;
+  bp = bread(ip->dev, b);
+  memset(bp->data, 0, bsize);
+  memmove(bp->data, h,
+          sizeof(*h) + h->nentries * sizeof(struct extent_entry));
+  bwrite(bp);
+  brelse(bp);
+
+  h->depth++;
+  h->nentries = 1;
+  eentries(h)[0].fbn = 0;
+  eentries(h)[0].startblkno = b;
+  eentries(h)[0].nblocks = 0;
+  return einsert(ip, h, NROOTENT, &ne);
 }
 
+// Allocate blocks for every unmapped file block in [from, to) of ip; the
+// blocks before from that are unmapped stay holes. New blocks go right
+// after the disk block of the file block before them while those are free,
+// so files written sequentially stay contiguous. New blocks are zeroed on
+// disk, those past the end of the file included, since a write or itruncate
+// may move the end past them later; only the blocks in [wfrom, wto), which
+// the caller overwrites whole, are not. Returns the number of blocks added,
+// or -1 if the disk is full.
+static int imapblocks(struct inode *ip, uint from, uint to, uint wfrom,
+                      uint wto) {
+  uint have, end, fbn, n, prev, b, got, i;
+  int added;
+
+  added = 0;
+  have = emapped(ip, &end);
+  for (fbn = from; fbn < to; fbn += got) {
+    // Flat extents have no holes
+    if (fbn < have && !(ip->flags & DI_ETREE)) {
+      got = min(to, have) - fbn;
+      continue;
+    }
+    got = 1;
+    if (fbn < have && emap(ip, fbn) != 0)
+      continue;
 
-static int readfromextent(struct inode* node, char* dst, int off, int n) {
+    // Find the length of the hole at fbn
+    if (fbn >= have) {
+      n = to - fbn;
+    } else {
+      for (n = 1; fbn + n < to && fbn + n < have && emap(ip, fbn + n) == 0;
+           n++)
+        ;
+    }
 
-  bool reading = false;
-  int totalsize = 0;
-  int totalwritten = 0;
-  
+    // Place the new blocks right after those of file block fbn - 1
+    prev = 0;
+    if (fbn == have)
+      prev = end;
+    else if (fbn > 0 && (prev = emap(ip, fbn - 1)) != 0)
+      prev++;
+    got = 0;
+    if (prev != 0 && prev < sb.size)
+      got = bextend(ip->dev, prev, n);
+    if (got > 0)
+      b = prev;
+    else if ((b = balloc(ip->dev, n, &got)) == 0)
+      return -1;
 
-  // Iterate through every data field
-  for(int i = 0; i < 30; i++) {
-    
-    // We are reading beyond file bounds, return error
-    if(node->data[i].nblocks == 0) {
-        return -1;
+    if (eadd(ip, fbn, b, got) == -1) {
+      bfree(ip->dev, b, got);
+      return -1;
+    }
+    added += got;
+    if (fbn + got > have) {
+      have = fbn + got;
+      end = b + got;
     }
 
-    // Skip this extents blocks
-    if(off > totalsize + (node->data[i].nblocks * BSIZE)){
-      totalsize += node->data[i].nblocks * BSIZE;
+    for (i = 0; i < got; i++)
+      if (fbn + i < wfrom || fbn + i >= wto)
+        bzero(ip->dev, b + i);
+  }
+  return added;
+}
+
+// Cut the leaf entry of tree ip covering file block fbn short so it ends
+// at fbn, removing it if it starts there.
+static void ecut(struct inode *ip, uint fbn) {
+  struct extent_header *h;
+  struct extent_entry *e;
+  struct buf *bp;
+  uint child;
+  int i;
+
+  bp = 0;
+  h = eroot(ip);
+  while (h->depth > 0) {
+    child = eentries(h)[esearch(h, fbn)].startblkno;
+    if (bp)
+      brelse(bp);
+    bp = bread(ip->dev, child);
+    h = (struct extent_header *)bp->data;
+  }
+
+  e = eentries(h);
+  i = esearch(h, fbn);
+  if (e[i].fbn == fbn) {
+    memmove(&e[i], &e[i + 1],
+            (h->nentries - i - 1) * sizeof(struct extent_entry));
+    h->nentries--;
+  } else {
+    e[i].nblocks = fbn - e[i].fbn;
+  }
+  if (bp) {
+    bwrite(bp);
+    brelse(bp);
+  }
+}
+
+// Give ip blocks of its own in place of the shared blocks that bytes
+// [off, off + n) touch, so writing there does not show through in the
+// files it shares them with. Blocks the range covers completely are not
+// copied, since the write replaces all of their bytes. Caller must hold
+// ip->lock.
+static int iunshare(struct inode *ip, uint off, uint n) {
+  struct bfreebatch fb = {ip->dev, 0};
+  struct extent_entry ext;
+  uint fbn, to, b, k, max, nb, got, i, f;
+  char *cbuf;
+
+  cbuf = 0;
+  to = (off + n + bsize - 1) / bsize;
+  for (fbn = off / bsize; fbn < to; fbn += k) {
+    k = 1;
+    if (efind(ip, fbn, &ext) == -1)
       continue;
+    b = ext.startblkno + (fbn - ext.fbn);
+    if (rcget(b) == 0)
+      continue;
+
+    // The run of shared blocks in this extent
+    max = min(to, ext.fbn + ext.nblocks) - fbn;
+    while (k < max && rcget(b + k) > 0)
+      k++;
+    if ((nb = balloc(ip->dev, k, &got)) == 0)
+      goto bad;
+    k = got;
+
+    for (i = 0; i < k; i++) {
+      f = fbn + i;
+      if (f * bsize >= off && (f + 1) * bsize <= off + n)
+        continue;
+      if (!cbuf && !(cbuf = kalloc())) {
+        bfree(ip->dev, nb, k);
+        goto bad;
+      }
+      breaddirect(ip->dev, b + i, (uchar *)cbuf);
+      bwritedirect(ip->dev, nb + i, (uchar *)cbuf);
     }
 
-    int blocksdeep = 0;
-    blocksdeep = (off - totalsize) / BSIZE;
-    totalsize += (blocksdeep * BSIZE);
+    // Swap the new blocks into the extent map, then drop the references
+    // to the old ones
+    if (!(ip->flags & DI_ETREE) && etreeconvert(ip) == -1) {
+      bfree(ip->dev, nb, k);
+      goto bad;
+    }
+    ecut(ip, fbn);
+    if (ext.fbn + ext.nblocks > fbn + k &&
+        eadd(ip, fbn + k, b + k, ext.fbn + ext.nblocks - (fbn + k)) == -1)
+      goto bad;
+    if (eadd(ip, fbn, nb, k) == -1)
+      goto bad;
+    // Another sharer may have let go of the blocks since rcget
+    rcdrop(b, k, &fb);
+    bfreeflush(&fb);
+  }
+  if (cbuf)
+    kfree(cbuf);
+  return 0;
 
-    // For each extent's blocks
-    for(int j = blocksdeep; j < node->data[i].nblocks; j++) {
-    
+bad:
+  if (cbuf)
+    kfree(cbuf);
+  return -1;
+}
 
-      // Acknowledge we visited this block
-      totalsize += BSIZE;
+// Give the copy of a tree node at h, made for a clone, node blocks of its
+// own below it, and take a reference on every data block it maps. On
+// failure the node keeps only the entries that were copied.
+static int ecopy(struct inode *ip, struct extent_header *h) {
+  struct extent_entry *e = eentries(h);
+  struct buf *bp, *nbp;
+  uint b, got;
+  int i, r;
+
+  for (i = 0; i < h->nentries; i++) {
+    if (h->depth == 0) {
+      if (rcinc(e[i].startblkno, e[i].nblocks) == -1) {
+        h->nentries = i;
+        return -1;
+      }
+      continue;
+    }
+    if ((b = balloc(ip->dev, 1, &got)) == 0) {
+      h->nentries = i;
+      return -1;
+    }
+    bp = bread(ip->dev, e[i].startblkno);
+    nbp = bread(ip->dev, b);
+    memmove(nbp->data, bp->data, bsize);
+    brelse(bp);
+    r = ecopy(ip, (struct extent_header *)nbp->data);
+    bwrite(nbp);
+    brelse(nbp);
+    e[i].startblkno = b;
+    if (r == -1) {
+      h->nentries = i + 1;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Make dst a copy of src that shares src's data blocks. Both files are
+// marked DI_SHARED, and each block's reference count goes up by one.
+// Caller must hold both locks.
+static int iclone(struct inode *dst, struct inode *src) {
+  int i, r;
+
+  if (itruncate(dst, 0) == -1)
+    return -1;
+
+  memmove(dst->data, src->data, sizeof(dst->data));
+  if (src->flags & DI_INLINE) {
+    dst->flags = src->flags;
+    dst->size = src->size;
+    iupdate(dst);
+    return 0;
+  }
 
-      // We've reached the block the offset is in, so now we start
-      // writing n data
-      if(totalsize > off) {
-        reading = true;
+  if (!(src->flags & DI_SHARED)) {
+    src->flags |= DI_SHARED;
+    iupdate(src);
+  }
+  dst->flags = src->flags;
+  r = 0;
+  if (dst->flags & DI_ETREE) {
+    r = ecopy(dst, eroot(dst));
+  } else {
+    for (i = 0; i < 30 && dst->data[i].nblocks != 0; i++) {
+      if (rcinc(dst->data[i].startblkno, dst->data[i].nblocks) == -1) {
+        // Keep only the extents whose references were taken
+        memset(&dst->data[i], 0, (30 - i) * sizeof(struct extent));
+        r = -1;
+        break;
       }
+    }
+  }
+  if (r == -1) {
+    itrunc(dst);
+    iupdate(dst);
+    return -1;
+  }
+  dst->size = src->size;
+  iupdate(dst);
+  return 0;
+}
 
-      // Write data to the current block
-      if(reading) {
-        
-        // Within the given inodes device, begin reading at the extent the
-        // offset specifies
-        struct buf* bp = bread(node->dev, node->data[i].startblkno + j);
+// threadsafe iclone. Returns -1 if either inode is not a regular file or
+// both are the same file.
+int concurrent_clonei(struct inode *dst, struct inode *src) {
+  int retval;
 
-        // Writes us to the next block
-        int m = min(n, BSIZE - (off % BSIZE));
+  if (dst == src)
+    return -1;
 
-        // move where we are at in a given block
-        // we are writing to
-        memset(dst, 0, m);
-        memmove(dst, bp->data + off % BSIZE, m);
-        brelse(bp);
+  // Lock in inum order, so clones in opposite directions can't deadlock
+  if (dst->inum < src->inum) {
+    locki(dst);
+    locki(src);
+  } else {
+    locki(src);
+    locki(dst);
+  }
+  retval = -1;
+  if (dst->type == T_FILE && src->type == T_FILE)
+    retval = iclone(dst, src);
+  unlocki(src);
+  unlocki(dst);
 
-        // Increment offset in write's buffer
-        dst += m;
+  return retval;
+}
 
-        // Used to determine how much we can write based on how much we have written already
-        totalwritten += m;
-        
-        // Decrement how much we have left to write from what we
-        n -= m;
+static void itrunc(struct inode *ip) {
+  struct bfreebatch fb = {ip->dev, 0};
+  int i;
+
+  if (ipcached(ip))
+    pcdrop(ip);
 
-        // Where we are at in a given block
-        off += m;
+  if (ip->flags & DI_ETREE) {
+    efree(ip, eroot(ip), &fb);
+  } else if (!(ip->flags & DI_INLINE)) {
+    for (i = 0; i < 30 && ip->data[i].nblocks != 0; i++)
+      bfreedata(ip, &fb, ip->data[i].startblkno, ip->data[i].nblocks);
+  }
+  bfreeflush(&fb);
+  memset(ip->data, 0, sizeof(ip->data));
+  ip->flags &= ~DI_ETREE;
+  ip->size = 0;
+}
+
+// Set the size of regular file ip to size. Shrinking frees every block
+// past the new end of the file, blocks preallocated by iallocate included.
+// Growing leaves a hole, which reads as zeros. Caller must hold ip->lock.
+static int itruncate(struct inode *ip, uint size) {
+  struct bfreebatch fb = {ip->dev, 0};
+  struct pcpage *pg;
+  uint keep, fbn, have, end, oldsize;
+  int i;
+
+  if (size > ip->size) {
+    if ((ip->flags & DI_INLINE) && size <= INLINESIZE) {
+      memset((char *)ip->data + ip->size, 0, size - ip->size);
+    } else {
+      if ((ip->flags & DI_INLINE) && inlinetoextent(ip) == -1)
+        return -1;
+
+      // Zero the rest of the last block. Blocks preallocated past the end
+      // of the file were zeroed by iallocate.
+      have = emapped(ip, &end);
+      if ((ip->flags & DI_SHARED) && have * bsize > ip->size &&
+          iunshare(ip, ip->size, min(size, have * bsize) - ip->size) == -1)
+        return -1;
+      // A hole reads as zeros already
+      if (ip->size % bsize != 0 && emap(ip, ip->size / bsize) != 0) {
+        pg = pcget(ip, ip->size / PGSIZE);
+        pcwrite(ip, pg, ip->size % PGSIZE, 1);
+        pcput(pg);
       }
+    }
+    ip->size = size;
+    iupdate(ip);
+    return 0;
+  }
+
+  if (ip->flags & DI_INLINE) {
+    memset((char *)ip->data + size, 0, ip->size - size);
+    ip->size = size;
+    iupdate(ip);
+    return 0;
+  }
 
-      if(n == 0) {
+  keep = (size + bsize - 1) / bsize;
+  if (keep == 0) {
+    itrunc(ip);
+    iupdate(ip);
+    return 0;
+  }
 
-        return 0;
+  // Cached pages may hold bytes past the new end
+  oldsize = ip->size;
+  if (size < oldsize)
+    pcdrop(ip);
+  if (ip->flags & DI_ETREE) {
+    etrunc(ip, eroot(ip), keep, &fb);
+    if (eroot(ip)->nentries == 0)
+      eroot(ip)->depth = 0;
+  } else {
+    for (fbn = 0, i = 0; i < 30 && ip->data[i].nblocks != 0; i++) {
+      if (fbn >= keep) {
+        bfreedata(ip, &fb, ip->data[i].startblkno, ip->data[i].nblocks);
+        ip->data[i].startblkno = 0;
+        ip->data[i].nblocks = 0;
+      } else if (fbn + ip->data[i].nblocks > keep) {
+        bfreedata(ip, &fb, ip->data[i].startblkno + (keep - fbn),
+                  fbn + ip->data[i].nblocks - keep);
+        ip->data[i].nblocks = keep - fbn;
+        fbn = keep;
+      } else {
+        fbn += ip->data[i].nblocks;
       }
     }
-  
   }
+  bfreeflush(&fb);
+  ip->size = size;
+  iupdate(ip);
+
+  // Zero the rest of the last block on disk, so growing the file again
+  // can't bring back the old bytes. pcget reads them as zero already, and
+  // there is nothing to zero if the new end falls in a hole.
+  if (size < oldsize && size % bsize != 0 && emap(ip, size / bsize) != 0) {
+    if ((ip->flags & DI_SHARED) && iunshare(ip, size, 1) == -1)
+      return -1;
+    pg = pcget(ip, size / PGSIZE);
+    pcwrite(ip, pg, size % PGSIZE, 1);
+    pcput(pg);
+  }
+  return 0;
+}
 
-  // We already have 30 extents
-  return -1;
+// Map blocks for bytes [off, off + len) of regular file ip without writing
+// them, so later writes there need no allocation. New blocks are taken as
+// one contiguous run if the disk has one, and zeroed. Blocks past the end
+// of the file stay unused until a write or itruncate reaches them. Caller
+// must hold ip->lock.
+static int iallocate(struct inode *ip, uint off, uint len) {
+  int added;
+
+  if (off + len < off)
+    return -1;
+  if (ip->flags & DI_INLINE) {
+    if (off + len <= INLINESIZE)
+      return 0;
+    if (inlinetoextent(ip) == -1)
+      return -1;
+  }
+
+  added = imapblocks(ip, off / bsize, (off + len + bsize - 1) / bsize, 0, 0);
+  iupdate(ip);
+  return added == -1 ? -1 : 0;
+}
+
+// threadsafe itruncate. Returns -1 if ip is not a regular file.
+int concurrent_truncatei(struct inode *ip, uint size) {
+  int retval;
+
+  locki(ip);
+  retval = ip->type == T_FILE ? itruncate(ip, size) : -1;
+  unlocki(ip);
+
+  return retval;
+}
+
+// threadsafe iallocate, growing the file to off + len (with zeros) unless
+// keepsize is set. Returns -1 if ip is not a regular file.
+int concurrent_allocatei(struct inode *ip, uint off, uint len,
+                         bool keepsize) {
+  int retval;
+
+  locki(ip);
+  retval = -1;
+  if (ip->type == T_FILE && iallocate(ip, off, len) == 0) {
+    retval = 0;
+    if (!keepsize && off + len > ip->size)
+      retval = itruncate(ip, off + len);
+  }
+  unlocki(ip);
+
+  return retval;
+}
+
+// Online defragmentation.
+//
+// idefrag moves the data of a fragmented file into one contiguous run of
+// free blocks. The data is copied into the run first, while the run is
+// only reserved in memory (see breserve). Then the run's allocation, the
+// freeing of the old blocks and the new dinode reach the disk together in
+// one log transaction (see lio.c), so after a crash the file is either all
+// in its old blocks or all in the new run. The bitmap blocks and the
+// inodefile block of the transaction stay locked from the first change
+// until logcommit has installed them, and the inodefile lock is held
+// around the rewrite of the dinode, as for write_dinode.
+
+struct defrag {
+  uint dev;
+  uint nextents; // leaf extents of the old map
+  uint nnodes;   // extent tree node blocks of the old map
+  uint nblocks;  // data blocks mapped
+  uint nruns;    // runs of file blocks with no hole between them
+  bool contig;   // each extent starts on disk where the one before ends
+  uint fbnend;   // file block just past the last extent seen
+  uint blkend;   // disk block just past the last extent seen
+  struct extent_entry run[NROOTENT]; // the new map, one entry per run
+  uint start;    // first block of the new run
+  uint copied;   // blocks copied into it so far
+  uchar *page;   // copy buffer
+  // Bitmap blocks the transaction updates, sorted; nbmap is -1 if there
+  // are too many. The inodefile block takes the last slot of MAXOPBLOCKS.
+  uint bmap[MAXOPBLOCKS - 1];
+  struct buf *bp[MAXOPBLOCKS - 1];
+  int nbmap;
+};
+
+// Add the bitmap blocks covering disk blocks [b, b + n) to those of df.
+static void dfaddbmap(struct defrag *df, uint b, uint n) {
+  uint bb;
+  int i, j;
+
+  for (bb = BBLOCK(b, sb); df->nbmap >= 0 && bb <= BBLOCK(b + n - 1, sb);
+       bb++) {
+    for (i = 0; i < df->nbmap && df->bmap[i] < bb; i++)
+      ;
+    if (i < df->nbmap && df->bmap[i] == bb)
+      continue;
+    if (df->nbmap == NELEM(df->bmap)) {
+      df->nbmap = -1;
+      return;
+    }
+    for (j = df->nbmap; j > i; j--)
+      df->bmap[j] = df->bmap[j - 1];
+    df->bmap[i] = bb;
+    df->nbmap++;
+  }
+}
+
+// Measure the old map and plan the new one.
+static void dfstat(void *arg, struct extent_entry *e, bool leaf) {
+  struct defrag *df = arg;
+
+  if (!leaf) {
+    df->nnodes++;
+    dfaddbmap(df, e->startblkno, 1);
+    return;
+  }
+  if (df->nextents > 0 && e->startblkno != df->blkend)
+    df->contig = false;
+  if (df->nextents == 0 || e->fbn != df->fbnend) {
+    if (df->nruns < NROOTENT)
+      df->run[df->nruns].fbn = e->fbn;
+    df->nruns++;
+  }
+  if (df->nruns <= NROOTENT)
+    df->run[df->nruns - 1].nblocks += e->nblocks;
+  df->nextents++;
+  df->nblocks += e->nblocks;
+  df->fbnend = e->fbn + e->nblocks;
+  df->blkend = e->startblkno + e->nblocks;
+  dfaddbmap(df, e->startblkno, e->nblocks);
+}
+
+// Copy the blocks of an extent to the next blocks of the new run.
+static void dfcopy(void *arg, struct extent_entry *e, bool leaf) {
+  struct defrag *df = arg;
+  uint i;
+
+  for (i = 0; leaf && i < e->nblocks; i++, df->copied++) {
+    breaddirect(df->dev, e->startblkno + i, df->page);
+    bwritedirect(df->dev, df->start + df->copied, df->page);
+  }
+}
+
+// Mark disk blocks [b, b + n) used or free in the held bitmap blocks.
+static void dfmark(struct defrag *df, uint b, uint n, bool used) {
+  uint m;
+  int i;
+
+  while (n > 0) {
+    m = min(n, BPB(sb) - b % BPB(sb));
+    for (i = 0; df->bmap[i] != BBLOCK(b, sb); i++)
+      ;
+    bmark(df->bp[i], b % BPB(sb), b % BPB(sb) + m - 1, used);
+    b += m;
+    n -= m;
+  }
+}
+
+// Free the blocks of an extent, or a node block, in the held bitmap blocks.
+static void dffree(void *arg, struct extent_entry *e, bool leaf) {
+  dfmark(arg, e->startblkno, leaf ? e->nblocks : 1, false);
+}
+
+// Move the blocks of ip into one contiguous run, keeping its holes. The
+// new map has one extent per run of file blocks between holes. Sets
+// *before and *after to the number of extents before and after. Fails if
+// the file's blocks may be shared with a clone, the new map would not fit
+// in the dinode, the transaction would not fit in MAXOPBLOCKS blocks, or
+// there is no free run long enough. Caller must hold ip->lock.
+static int idefrag(struct inode *ip, uint *before, uint *after) {
+  struct defrag df;
+  struct dinode di;
+  struct extent_header *h;
+  struct buf *dbp;
+  uint dblk, b;
+  int i;
+
+  *before = *after = 0;
+  if (ip->inum == INODEFILEINO || ip->inum == REFCNTINO ||
+      (ip->flags & DI_SHARED))
+    return -1;
+  if (ip->flags & DI_INLINE)
+    return 0;
+
+  memset(&df, 0, sizeof(df));
+  df.dev = ip->dev;
+  df.contig = true;
+  eforeach(ip, dfstat, &df);
+  *before = *after = df.nextents;
+  if (df.contig && df.nnodes == 0 && df.nextents == df.nruns)
+    return 0;
+
+  // The run has to come from one bitmap block, whose buffer gets the slot
+  // left free here
+  if (df.nruns > NROOTENT || df.nblocks > BPB(sb) || df.nbmap < 0 ||
+      df.nbmap == NELEM(df.bmap))
+    return -1;
+  if ((df.page = (uchar *)kalloc()) == 0)
+    return -1;
+  acquiresleep(&bresv.owner);
+  if ((df.start = breserve(ip->dev, df.nblocks)) == 0) {
+    releasesleep(&bresv.owner);
+    kfree((char *)df.page);
+    return -1;
+  }
+  dfaddbmap(&df, df.start, df.nblocks);
+
+  eforeach(ip, dfcopy, &df);
+  kfree((char *)df.page);
 
+  locki(&icache.inodefile);
+  dblk = emap(&icache.inodefile, INODEOFF(ip->inum) / bsize);
+
+  logbegin();
+  for (i = 0; i < df.nbmap; i++)
+    df.bp[i] = bread(ip->dev, df.bmap[i]);
+  dfmark(&df, df.start, df.nblocks, true);
+  bunreserve();
+  releasesleep(&bresv.owner);
+  eforeach(ip, dffree, &df);
+
+  memset(ip->data, 0, sizeof(ip->data));
+  if (df.nruns == 1 && df.run[0].fbn == 0) {
+    ip->flags &= ~DI_ETREE;
+    ip->data[0].startblkno = df.start;
+    ip->data[0].nblocks = df.nblocks;
+  } else {
+    ip->flags |= DI_ETREE;
+    h = eroot(ip);
+    h->depth = 0;
+    h->nentries = df.nruns;
+    for (b = df.start, i = 0; i < df.nruns; b += df.run[i].nblocks, i++) {
+      df.run[i].startblkno = b;
+      eentries(h)[i] = df.run[i];
+    }
+  }
+  idinode(ip, &di);
+  dbp = bread(ip->dev, dblk);
+  memmove(dbp->data + INODEOFF(ip->inum) % bsize, &di, sizeof(di));
+
+  for (i = 0; i < df.nbmap; i++)
+    logwrite(df.bp[i], df.bmap[i]);
+  logwrite(dbp, dblk);
+  logcommit();
+
+  brelse(dbp);
+  for (i = 0; i < df.nbmap; i++) {
+    df.bp[i]->flags &= ~B_DIRTY; // installed by logcommit
+    brelse(df.bp[i]);
+  }
+  unlocki(&icache.inodefile);
+  *after = df.nruns;
+  return 0;
 }
+
+// threadsafe idefrag. Returns -1 if ip is not a regular file.
+int concurrent_defragi(struct inode *ip, uint *before, uint *after) {
+  int retval;
+
+  locki(ip);
+  retval = ip->type == T_FILE ? idefrag(ip, before, after) : -1;
+  unlocki(ip);
+
+  return retval;
+}
+
+// File layout.
+//
+// ifiemap reports where a file's data sits on disk, for tools that place or
+// schedule I/O by layout (see inc/stat.h).
+
+struct fiemapwalk {
+  struct fiemap *fm;
+  struct fiemap_extent *ext; // where to copy the first n extents
+  uint n;
+  uint blkend;               // disk block just past the last extent seen
+};
+
+static void fmvisit(void *arg, struct extent_entry *e, bool leaf) {
+  struct fiemapwalk *w = arg;
+  struct fiemap *fm = w->fm;
+
+  if (!leaf) {
+    fm->nnodes++;
+    return;
+  }
+  if (fm->nextents == 0 || e->startblkno != w->blkend)
+    fm->nfrags++;
+  if (fm->nextents < w->n) {
+    w->ext[fm->nextents].fbn = e->fbn;
+    w->ext[fm->nextents].blkno = e->startblkno;
+    w->ext[fm->nextents].nblocks = e->nblocks;
+  }
+  fm->nextents++;
+  fm->nblocks += e->nblocks;
+  w->blkend = e->startblkno + e->nblocks;
+}
+
+// Fill in *fm for ip and copy its first n extents, in file block order,
+// to ext. Returns the number of extents copied. Caller must hold ip->lock.
+static int ifiemap(struct inode *ip, struct fiemap *fm,
+                   struct fiemap_extent *ext, uint n) {
+  struct fiemapwalk w;
+
+  memset(fm, 0, sizeof(*fm));
+  fm->bsize = bsize;
+  fm->size = ip->size;
+  if (ip->flags & DI_INLINE)
+    fm->flags |= FIEMAP_INLINE;
+  if (ip->flags & DI_ETREE)
+    fm->flags |= FIEMAP_TREE;
+  if (ip->flags & DI_SHARED)
+    fm->flags |= FIEMAP_SHARED;
+  if (ip->flags & DI_INLINE)
+    return 0;
+
+  w.fm = fm;
+  w.ext = ext;
+  w.n = n;
+  w.blkend = 0;
+  eforeach(ip, fmvisit, &w);
+  return min(n, fm->nextents);
+}
+
+// threadsafe ifiemap. Returns -1 if ip is a device.
+int concurrent_fiemapi(struct inode *ip, struct fiemap *fm,
+                       struct fiemap_extent *ext, uint n) {
+  int retval;
+
+  locki(ip);
+  retval = ip->type == T_DEV ? -1 : ifiemap(ip, fm, ext, n);
+  unlocki(ip);
+
+  return retval;
+}
+
 // Directories
 
 int namecmp(const char *s, const char *t) { return strncmp(s, t, DIRSIZ); }
 
 struct inode *rootlookup(char *name) {
-  return dirlookup(namei("/"), name, 0);
+  struct inode *ip;
+
+  locki(icache.root);
+  ip = dirlookup(icache.root, name, 0);
+  unlocki(icache.root);
+  return ip;
+}
+
+// Directory index.
+//
+// Scanning a directory costs one readi per dirent, and creating a file
+// used to need a second scan to find a free slot. Instead, the first lookup
+// in a directory reads its dirents once and builds an in-memory hash table
+// from name to (inum, offset), along with a list of the offsets of free
+// slots left behind by unlink. dirlink and dirunlink keep the index in sync
+// with the directory on disk. The index hangs off of the in-memory inode
+// and is protected by the directory's inode lock. If memory for the index
+// runs out it is dropped, and lookups fall back to scanning the directory.
+
+#define NDIRHASH 256
+
+struct dirindex_ent {
+  char name[DIRSIZ];
+  ushort inum;
+  uint off;
+  struct dirindex_ent *next;
+};
+
+// A page of index entries.
+struct dirindex_chunk {
+  struct dirindex_chunk *next;
+  struct dirindex_ent ents[(PGSIZE - sizeof(void *)) / sizeof(struct dirindex_ent)];
+};
+
+struct dirindex {
+  struct dirindex_ent *buckets[NDIRHASH];
+  struct dirindex_ent *holes;     // free dirent slots in the directory
+  struct dirindex_ent *unused;    // entries not in a bucket or in holes
+  struct dirindex_chunk *chunks;  // pages backing the entries
+};
+
+static uint dirhash(char *name) {
+  uint h = 0;
+  for (int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDIRHASH;
+}
+
+static struct dirindex_ent *dindex_newent(struct dirindex *di) {
+  struct dirindex_chunk *c;
+  struct dirindex_ent *e;
+
+  if (!di->unused) {
+    if (!(c = (struct dirindex_chunk *)kalloc()))
+      return 0;
+    c->next = di->chunks;
+    di->chunks = c;
+    for (e = c->ents; e < &c->ents[NELEM(c->ents)]; e++) {
+      e->next = di->unused;
+      di->unused = e;
+    }
+  }
+  e = di->unused;
+  di->unused = e->next;
+  return e;
+}
+
+static void dindex_drop(struct inode *ip) {
+  struct dirindex_chunk *c, *next;
+
+  if (!ip->dindex)
+    return;
+  for (c = ip->dindex->chunks; c; c = next) {
+    next = c->next;
+    kfree((char *)c);
+  }
+  kfree((char *)ip->dindex);
+  ip->dindex = 0;
+}
+
+// Record the dirent at offset off of the directory in its index.
+static int dindex_add(struct dirindex *di, struct dirent *de, uint off) {
+  struct dirindex_ent *e;
+
+  if (!(e = dindex_newent(di)))
+    return -1;
+  e->inum = de->inum;
+  e->off = off;
+  if (de->inum == 0) {
+    e->next = di->holes;
+    di->holes = e;
+  } else {
+    memmove(e->name, de->name, DIRSIZ);
+    e->next = di->buckets[dirhash(de->name)];
+    di->buckets[dirhash(de->name)] = e;
+  }
+  return 0;
+}
+
+// Build the index of dp by reading every dirent in it once.
+// Caller must hold dp->lock.
+static void dindex_build(struct inode *dp) {
+  struct dirent des[MINBSIZE / sizeof(struct dirent)];
+  uint off, n, i;
+
+  if (!(dp->dindex = (struct dirindex *)kalloc()))
+    return;
+  memset(dp->dindex, 0, sizeof(struct dirindex));
+
+  for (off = 0; off < dp->size; off += sizeof(des)) {
+    n = min((uint)sizeof(des), dp->size - off);
+    if (readi(dp, (char *)des, off, n) != n)
+      panic("dindex_build read");
+    for (i = 0; i < n / sizeof(struct dirent); i++) {
+      if (dindex_add(dp->dindex, &des[i], off + i * sizeof(struct dirent)) == -1) {
+        dindex_drop(dp);
+        return;
+      }
+    }
+  }
+}
+
+static struct dirindex_ent *dindex_find(struct dirindex *di, char *name) {
+  struct dirindex_ent *e;
+
+  for (e = di->buckets[dirhash(name)]; e; e = e->next)
+    if (namecmp(name, e->name) == 0)
+      return e;
+  return 0;
 }
 
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock.
 struct inode *dirlookup(struct inode *dp, char *name, uint *poff) {
   uint off, inum;
   struct dirent de;
+  struct dirindex_ent *e;
 
   if (dp->type != T_DIR)
     panic("dirlookup not DIR");
+  if (!holdingsleep(&dp->lock))
+    panic("dirlookup not locked");
+
+  if (!dp->dindex)
+    dindex_build(dp);
+
+  if (dp->dindex) {
+    if (!(e = dindex_find(dp->dindex, name)))
+      return 0;
+    if (poff)
+      *poff = e->off;
+    return iget(dp->dev, e->inum);
+  }
 
   for (off = 0; off < dp->size; off += sizeof(de)) {
     if (readi(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
@@ -934,6 +2847,83 @@ struct inode *dirlookup(struct inode *dp, char *name, uint *poff) {
   return 0;
 }
 
+// Write a new directory entry (name, inum) into the directory dp, reusing
+// a free slot if there is one. Returns 0 on success, -1 on failure.
+// Caller must hold dp->lock.
+int dirlink(struct inode *dp, char *name, uint inum) {
+  struct dirent de;
+  struct dirindex_ent *e;
+  uint off;
+
+  if (!dp->dindex)
+    dindex_build(dp);
+
+  // Find a free slot, either from the index or by scanning
+  e = 0;
+  if (dp->dindex) {
+    if ((e = dp->dindex->holes))
+      off = e->off;
+    else
+      off = dp->size;
+  } else {
+    for (off = 0; off < dp->size; off += sizeof(de)) {
+      if (readi(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if (de.inum == 0)
+        break;
+    }
+  }
+
+  memset(&de, 0, sizeof(de));
+  strncpy(de.name, name, DIRSIZ);
+  de.inum = inum;
+  if (writei(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
+    return -1;
+  dcacheinsert(dp->dev, dp->inum, name, inum);
+
+  if (dp->dindex) {
+    if (e) {
+      // Move the hole's entry over to its name's bucket
+      dp->dindex->holes = e->next;
+      e->next = dp->dindex->unused;
+      dp->dindex->unused = e;
+    }
+    if (dindex_add(dp->dindex, &de, off) == -1)
+      dindex_drop(dp);
+  }
+  return 0;
+}
+
+// Clear the directory entry for name at offset off in dp, leaving a free
+// slot behind for a later dirlink. Returns 0 on success, -1 on failure.
+// Caller must hold dp->lock.
+int dirunlink(struct inode *dp, char *name, uint off) {
+  struct dirent de;
+  struct dirindex_ent *e, **pp;
+
+  dcacheinvalidate(dp->dev, dp->inum, name);
+
+  memset(&de, 0, sizeof(de));
+  if (writei(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
+    return -1;
+  dcacheinsert(dp->dev, dp->inum, name, 0);
+
+  if (dp->dindex) {
+    for (pp = &dp->dindex->buckets[dirhash(name)]; (e = *pp); pp = &e->next) {
+      if (e->off == off) {
+        *pp = e->next;
+        e->inum = 0;
+        e->next = dp->dindex->holes;
+        dp->dindex->holes = e;
+        return 0;
+      }
+    }
+    // The index is out of sync with the directory
+    dindex_drop(dp);
+  }
+  return 0;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -974,16 +2964,31 @@ static char *skipelem(char *path, char *name) {
 // Look up and return the inode for a path name. Returns NULL if not found
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
-// Must be called inside a transaction since it calls iput().
+// Relative paths start from the current directory of the process, which
+// is the root until it first calls chdir.
 static struct inode *namex(char *path, int nameiparent, char *name) {
   struct inode *ip, *next;
+  uint inum;
 
-  if (*path == '/')
-    ip = iget(ROOTDEV, ROOTINO);
+  if (*path == '/' || myproc()->cwd == NULL)
+    ip = idup(icache.root);
   else
-    ip = idup(namei("/"));
+    ip = idup(myproc()->cwd);
 
   while ((path = skipelem(path, name)) != 0) {
+    // Try the dentry cache before locking and searching the directory.
+    // Entries only exist for names looked up in directories, so a hit
+    // also means ip is a directory.
+    if (!(nameiparent && *path == '\0')
+        && dcachelookup(ip->dev, ip->inum, name, &inum)) {
+      if (inum == 0)
+        goto notfound;
+      next = iget(ip->dev, inum);
+      irelease(ip);
+      ip = next;
+      continue;
+    }
+
     locki(ip);
     if (ip->type != T_DIR) {
       unlocki(ip);
@@ -997,9 +3002,11 @@ static struct inode *namex(char *path, int nameiparent, char *name) {
     }
 
     if ((next = dirlookup(ip, name, 0)) == 0) {
+      dcacheinsert(ip->dev, ip->inum, name, 0);
       unlocki(ip);
       goto notfound;
     }
+    dcacheinsert(ip->dev, ip->inum, name, next->inum);
 
     unlocki(ip);
     irelease(ip);
@@ -24,6 +24,7 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
@@ -63,6 +64,14 @@ void ideinit(void) {
     }
   }
 
+  // Let READ/WRITE MULTIPLE transfer a whole block of up to MAXBSIZE
+  // bytes per interrupt.
+  if (havedisk1) {
+    outb(0x1f2, MAXBSIZE / SECTOR_SIZE);
+    outb(0x1f7, IDE_CMD_SETMUL);
+    idewait(0);
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0 << 4));
 }
@@ -71,14 +80,14 @@ void ideinit(void) {
 static void idestart(struct buf *b) {
   if (b == 0)
     panic("idestart");
-  if (b->blockno >= FSSIZE)
-    panic("incorrect blockno");
-  int sector_per_block = BSIZE / SECTOR_SIZE;
+  int sector_per_block = bsize / SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ : IDE_CMD_RDMUL;
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7)
+  if (sector + sector_per_block > FSSIZE)
+    panic("incorrect blockno");
+  if (sector_per_block > MAXBSIZE / SECTOR_SIZE)
     panic("idestart");
 
   idewait(0);
@@ -90,7 +99,7 @@ static void idestart(struct buf *b) {
   outb(0x1f6, 0xe0 | ((b->dev & 1) << 4) | ((sector >> 24) & 0x0f));
   if (b->flags & B_DIRTY) {
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE / 4);
+    outsl(0x1f0, b->data, bsize / 4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -111,7 +120,7 @@ void ideintr(void) {
 
   // Read data if needed.
   if (!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE / 4);
+    insl(0x1f0, b->data, bsize / 4);
 
   // Wake process waiting for this buf.
   b->flags |= B_VALID;
@@ -105,10 +105,14 @@ void logbegin() {
 // To finish a transaction. Indicates to the journalling layer that all necessary
 // operations have been noted and can be flushed to disk. If this function
 // completes then client can be assured that operation will be reflected on disk.
+//
+// Logged blocks are installed straight from the log with bwritedirect, not
+// through the buffer cache, so a caller can keep the buffers it logged
+// locked until logcommit returns. That keeps other updates to those blocks
+// from getting in between logwrite and the install.
 void logcommit() {
 
   struct buf* logblock;
-  struct buf* extentblock;
 
   // Say the data we have batched is ready to be committed
   cachedheader.commit = 1;
@@ -125,29 +129,10 @@ void logcommit() {
       break;
     }    
 
-    // Acquire the log block
+    // Acquire the log block and write it to its home location
     logblock = bread(ROOTDEV, super.logstart + 1 + i);
-
-    // struct dinode test1;
-    // memmove(&test1, logblock->data, sizeof(struct dinode));
-
-    // struct dirent test2;
-    // for(int j = 0; j < 500; j += sizeof(struct dirent)) {
-    //   memmove(&test2, logblock->data + j, sizeof(struct dirent));
-    //   int stop = 0;
-    // }
-
-    // Acquire the actual location block
-    extentblock = bread(ROOTDEV, cachedheader.data[i]);
-    
-    // Move the data from the log block to the extent block
-    memmove(extentblock->data, logblock->data, BSIZE);
-    
-    bwrite(extentblock);
-
-    // Release the two buffers
+    bwritedirect(ROOTDEV, cachedheader.data[i], logblock->data);
     brelse(logblock);
-    brelse(extentblock);
   }
 
   // Finished committing everything
@@ -185,7 +170,7 @@ int logwrite(struct buf* block, uint location) {
   // store the block's data 
   int index = findlatestheaderidx(cachedheader.data);
   struct buf* logblock = bread(ROOTDEV, super.logstart + 1 + index);
-  memmove(logblock->data, block->data, BSIZE);
+  memmove(logblock->data, block->data, bsize);
   bwrite(logblock);
   brelse(logblock);
 
@@ -26,6 +26,8 @@ int main(uint64_t addr) {
   pinit();
   tvinit();   // trap vectors
   binit();    // buffer cache
+  dcacheinit(); // path name cache
+  pcacheinit(); // file page cache
   ideinit();  // disk
   userinit(); // first user process
   mpmain();
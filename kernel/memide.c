@@ -21,7 +21,7 @@ static uchar *memdisk;
 
 void ideinit(void) {
   memdisk = _binary_out_fs_img_start;
-  disksize = (uint64_t)_binary_out_fs_img_size / BSIZE;
+  disksize = (uint64_t)_binary_out_fs_img_size / MINBSIZE;
 }
 
 // Interrupt handler.
@@ -41,15 +41,15 @@ void iderw(struct buf *b) {
     panic("iderw: nothing to do");
   if (b->dev != 1)
     panic("iderw: request not for disk 1");
-  if (b->blockno >= disksize)
+  if ((uint64_t)(b->blockno + 1) * bsize > (uint64_t)disksize * MINBSIZE)
     panic("iderw: block out of range");
 
-  p = memdisk + b->blockno * BSIZE;
+  p = memdisk + (uint64_t)b->blockno * bsize;
 
   if (b->flags & B_DIRTY) {
     b->flags &= ~B_DIRTY;
-    memmove(p, b->data, BSIZE);
+    memmove(p, b->data, bsize);
   } else
-    memmove(b->data, p, BSIZE);
+    memmove(b->data, p, bsize);
   b->flags |= B_VALID;
 }
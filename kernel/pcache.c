@@ -0,0 +1,233 @@
+// Page cache.
+//
+// Caches the contents of regular files in PGSIZE pages indexed by (device,
+// inum, page number within the file). readi and writei move regular file
+// data through it, leaving the buffer cache (bio.c) to hold only metadata:
+// the bitmap, the inodefile, directories and extent tree blocks. Each page is
+// a whole physical frame from kalloc, so file data and user memory are kept
+// in the same units.
+//
+// Pages are filled and written back with direct block I/O (breaddirect and
+// bwritedirect), never through a struct buf. Writes go through to disk right
+// away, like bwrite, so an unused page can be dropped at any time.
+//
+// Interface:
+// * pcget returns a locked page of a file, reading it in if needed.
+//   The caller must hold the inode's lock, which keeps its block map stable.
+// * After changing page data, call pcwrite to write the changed bytes back.
+// * When done with the page, call pcput.
+// * pcdrop forgets the pages of a file whose blocks are being freed.
+// * pcmap takes a reference on a page's frame so a process can map it
+//   (see core_map_entry.reference). Processes running the same program
+//   share its text this way. A page whose frame is still mapped when it is
+//   recycled gets a new frame, and the old one is freed by its last unmap.
+
+#include <cdefs.h>
+#include <defs.h>
+#include <file.h>
+#include <fs.h>
+#include <memlayout.h>
+#include <mmu.h>
+#include <param.h>
+#include <pcache.h>
+#include <sleeplock.h>
+#include <spinlock.h>
+
+#define NPCHASH 64
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCPAGE];
+  struct pcpage *buckets[NPCHASH];
+
+  // Linked list of all pages, through prev/next.
+  // head.next is most recently used.
+  struct pcpage head;
+} pcache;
+
+void pcacheinit(void) {
+  struct pcpage *pg;
+
+  initlock(&pcache.lock, "pcache");
+
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for (pg = pcache.page; pg < pcache.page + NPCPAGE; pg++) {
+    if (!(pg->data = kalloc()))
+      panic("pcacheinit: out of memory");
+    initsleeplock(&pg->lock, "pcpage");
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+  }
+}
+
+static uint pchash(uint dev, uint inum, uint pgno) {
+  return (dev * 31 + inum * 17 + pgno) % NPCHASH;
+}
+
+// Remove pg from its hash chain. Caller must hold pcache.lock.
+static void pcunhash(struct pcpage *pg) {
+  struct pcpage **pp;
+
+  for (pp = &pcache.buckets[pchash(pg->dev, pg->inum, pg->pgno)]; *pp;
+       pp = &(*pp)->hnext) {
+    if (*pp == pg) {
+      *pp = pg->hnext;
+      break;
+    }
+  }
+  pg->hnext = 0;
+  pg->inum = 0;
+  pg->valid = 0;
+}
+
+// Whether a process maps pg's frame.
+static bool pcmapped(struct pcpage *pg) {
+  int ref;
+
+  acquirekmem();
+  ref = pa2page(V2P(pg->data))->reference;
+  releasekmem();
+  return ref > 1;
+}
+
+// Find the page for (ip, pgno), or recycle the least recently used
+// unused page for it, preferring pages no process maps. Returns the page
+// locked.
+static struct pcpage *pcfind(struct inode *ip, uint pgno) {
+  struct pcpage *pg;
+  char *data;
+  int pass;
+  uint h;
+
+  acquire(&pcache.lock);
+
+  h = pchash(ip->dev, ip->inum, pgno);
+  for (pg = pcache.buckets[h]; pg; pg = pg->hnext) {
+    if (pg->dev == ip->dev && pg->inum == ip->inum && pg->pgno == pgno) {
+      pg->ref++;
+      release(&pcache.lock);
+      acquiresleep(&pg->lock);
+      return pg;
+    }
+  }
+
+  for (pass = 0; pass < 2; pass++) {
+    for (pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev) {
+      if (pg->ref != 0 || (pass == 0 && pcmapped(pg)))
+        continue;
+      // Leave a mapped frame to the processes using it
+      if (pass == 1) {
+        if (!(data = kalloc()))
+          continue;
+        kfree(pg->data);
+        pg->data = data;
+      }
+      if (pg->inum != 0)
+        pcunhash(pg);
+      pg->dev = ip->dev;
+      pg->inum = ip->inum;
+      pg->pgno = pgno;
+      pg->ref = 1;
+      pg->hnext = pcache.buckets[h];
+      pcache.buckets[h] = pg;
+      release(&pcache.lock);
+      acquiresleep(&pg->lock);
+      return pg;
+    }
+  }
+  panic("pcget: no pages");
+}
+
+struct pcpage *pcget(struct inode *ip, uint pgno) {
+  struct pcpage *pg;
+  uint i, b, fbn, off;
+
+  if (!holdingsleep(&ip->lock))
+    panic("pcget");
+
+  pg = pcfind(ip, pgno);
+  if (!pg->valid) {
+    // Read every block of the page the file has. Bytes past the end of
+    // the file read as zero.
+    fbn = pgno * (PGSIZE / bsize);
+    for (i = 0; i < PGSIZE / bsize; i++) {
+      off = (fbn + i) * bsize;
+      if (off < ip->size && (b = emap(ip, fbn + i)) != 0)
+        breaddirect(ip->dev, b, (uchar *)pg->data + i * bsize);
+      else
+        memset(pg->data + i * bsize, 0, bsize);
+    }
+    if (pgno * PGSIZE < ip->size && ip->size < (pgno + 1) * PGSIZE)
+      memset(pg->data + ip->size % PGSIZE, 0, PGSIZE - ip->size % PGSIZE);
+    pg->valid = 1;
+  }
+  return pg;
+}
+
+// Write bytes [off, off + n) of pg back to the file's blocks on disk. The
+// blocks must already be allocated. Caller must hold pg and the inode locks.
+void pcwrite(struct inode *ip, struct pcpage *pg, uint off, uint n) {
+  uint fbn, b;
+
+  if (!holdingsleep(&pg->lock) || !holdingsleep(&ip->lock))
+    panic("pcwrite");
+
+  for (fbn = off / bsize; fbn * bsize < off + n; fbn++) {
+    b = emap(ip, pg->pgno * (PGSIZE / bsize) + fbn);
+    if (b == 0)
+      panic("pcwrite: block not allocated");
+    bwritedirect(ip->dev, b, (uchar *)pg->data + fbn * bsize);
+  }
+}
+
+// Take a reference on the frame of locked page pg for the caller to map
+// into a process. The mapping must be read-only (or copy-on-write): the
+// page cache writes file data into the frame in place.
+char *pcmap(struct pcpage *pg) {
+  if (!holdingsleep(&pg->lock))
+    panic("pcmap");
+
+  acquirekmem();
+  pa2page(V2P(pg->data))->reference++;
+  releasekmem();
+  return pg->data;
+}
+
+// Release a locked page.
+// Move to the head of the MRU list.
+void pcput(struct pcpage *pg) {
+  if (!holdingsleep(&pg->lock))
+    panic("pcput");
+
+  releasesleep(&pg->lock);
+
+  acquire(&pcache.lock);
+  pg->ref--;
+  if (pg->ref == 0) {
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+  }
+  release(&pcache.lock);
+}
+
+// Forget every cached page of ip, whose blocks are about to be freed.
+void pcdrop(struct inode *ip) {
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  for (pg = pcache.page; pg < pcache.page + NPCPAGE; pg++) {
+    if (pg->inum == ip->inum && pg->dev == ip->dev) {
+      if (pg->ref != 0)
+        panic("pcdrop: page in use");
+      pcunhash(pg);
+    }
+  }
+  release(&pcache.lock);
+}
@@ -182,6 +182,9 @@ int fork(void) {
     }
   }
 
+  // The child starts out in the parent's current directory
+  child->cwd = parent->cwd ? idup(parent->cwd) : NULL;
+
 
   // Call ptable lock so that when we are modifying the process in the ptable we don’t get
   // a write-write or a read-write race condition. Sequencer is constantly reading so we MUST lock otherwise we get a read-write
@@ -208,12 +211,21 @@ void exit(void) {
   // Call myproc to get the current process
   struct proc* process = myproc();
 
+  // Write back pages of shared file mappings while we can still sleep
+  vspacesync(&process->vspace);
+
   // Clean up as much memory as we can without actively deleting the ptable (AKA Clean up file_info 
   // array in the child since we don’t need these to be open for the exit call to finish running)
   for(int i = 0; i < NOFILE; i++) {
       fclose(i);
   }
 
+  // Drop the reference on the current directory
+  if(process->cwd) {
+    irelease(process->cwd);
+    process->cwd = NULL;
+  }
+
   // Call ptable lock since we are about to modify the global process table
   // (which could be written to or read from by other processes concurrently)
   acquire(&ptable.lock);
@@ -325,10 +337,10 @@ int sbrk(int amt) {
 
 
   // Check that adding this amount to the heap won't overflow us into the bottom
-  // of the stack. Return -1 if it does.
+  // of the stack or the file mappings. Return -1 if it does.
   uint64_t st = myproc()->vspace.regions[VR_USTACK].va_base
                 - myproc()->vspace.regions[VR_USTACK].size;
-  if(ht + amt >= st) {
+  if(ht + amt >= st || ht + amt > MMAPBASE) {
     return -1;
   }
 
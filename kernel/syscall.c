@@ -100,18 +100,34 @@ int argint64(int n, int64_t *ip) {
 // lies within the process address space.
 int argptr(int n, char **pp, int size) {
   int64_t i;
-  struct vregion *r;
-  struct vspace *v;
 
   if (argint64(n, &i) < 0)
     return -1;
+  if (checkptr(i, size) < 0)
+    return -1;
+  *pp = (char*)i;
+  return 0;
+}
+
+// Check that the size bytes at addr lie within the process address space.
+// Returns 0 if so, -1 otherwise.
+int checkptr(uint64_t addr, int size) {
+  uint64_t a;
+  struct vregion *r;
+  struct vspace *v;
+
   if (size < 0)
     return -1;
 
   v = &myproc()->vspace;
   for (r = v->regions; r < &v->regions[NREGIONS]; r++) {
-    if (vregioncontains(r, i, size)) {
-      *pp = (char*)i;
+    if (vregioncontains(r, addr, size)) {
+      // Read in pages of a mapped file now, before the call takes locks
+      // it can't sleep under (pipes, the console)
+      if (r->ip)
+        for (a = PGROUNDDOWN(addr); a < addr + size; a += PGSIZE)
+          if (vspacefault(v, a, false) < 0)
+            return -1;
       return 0;
     }
   }
@@ -148,6 +164,21 @@ extern int sys_uptime(void);
 extern int sys_sysinfo(void);
 extern int sys_crashn(void);
 extern int sys_unlink(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_lseek(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_ftruncate(void);
+extern int sys_fallocate(void);
+extern int sys_sendfile(void);
+extern int sys_clone_file(void);
+extern int sys_defrag(void);
+extern int sys_mkdir(void);
+extern int sys_chdir(void);
+extern int sys_fiemap(void);
 
 static int (*syscalls[])(void) = {
     [SYS_fork] = sys_fork,       [SYS_exit] = sys_exit,
@@ -159,7 +190,14 @@ static int (*syscalls[])(void) = {
     [SYS_uptime] = sys_uptime,   [SYS_open] = sys_open,
     [SYS_write] = sys_write,     [SYS_close] = sys_close,
     [SYS_sysinfo] = sys_sysinfo, [SYS_crashn] = sys_crashn,
-    [SYS_unlink] = sys_unlink,
+    [SYS_unlink] = sys_unlink,   [SYS_mmap] = sys_mmap,
+    [SYS_munmap] = sys_munmap,   [SYS_lseek] = sys_lseek,
+    [SYS_pread] = sys_pread,     [SYS_pwrite] = sys_pwrite,
+    [SYS_readv] = sys_readv,     [SYS_writev] = sys_writev,
+    [SYS_ftruncate] = sys_ftruncate, [SYS_fallocate] = sys_fallocate,
+    [SYS_sendfile] = sys_sendfile, [SYS_clone_file] = sys_clone_file,
+    [SYS_defrag] = sys_defrag,   [SYS_mkdir] = sys_mkdir,
+    [SYS_chdir] = sys_chdir,     [SYS_fiemap] = sys_fiemap,
 };
 
 void syscall(void) {
@@ -15,6 +15,7 @@
 #include <sleeplock.h>
 #include <spinlock.h>
 #include <stat.h>
+#include <uio.h>
 
 // Validates the file descriptor, returning -1 on a fail
 // and 0 on a success. Output parameter retfd
@@ -158,6 +159,173 @@ int sys_unlink(void) {
   
 }
 
+int sys_lseek(void) {
+  int fd, offset, whence;
+
+  if(argfd(0, &fd) == -1 || argint(1, &offset) == -1
+     || argint(2, &whence) == -1)
+    return -1;
+
+  return flseek(fd, offset, whence);
+}
+
+int sys_pread(void) {
+  char* buf;
+  int fd, n, offset;
+
+  if(argint(2, &n) == -1 || argint(3, &offset) == -1
+     || argptr(1, &buf, n) == -1 || argfd(0, &fd) == -1)
+    return -1;
+
+  return fpread(fd, buf, n, offset);
+}
+
+int sys_pwrite(void) {
+  char* buf;
+  int fd, n, offset;
+
+  if(argint(2, &n) == -1 || argint(3, &offset) == -1
+     || argptr(1, &buf, n) == -1 || argfd(0, &fd) == -1)
+    return -1;
+
+  return fpwrite(fd, buf, n, offset);
+}
+
+int sys_ftruncate(void) {
+  int fd, length;
+
+  if(argfd(0, &fd) == -1 || argint(1, &length) == -1)
+    return -1;
+
+  return fftruncate(fd, length);
+}
+
+int sys_fallocate(void) {
+  int fd, mode, offset, len;
+
+  if(argfd(0, &fd) == -1 || argint(1, &mode) == -1
+     || argint(2, &offset) == -1 || argint(3, &len) == -1)
+    return -1;
+
+  return ffallocate(fd, mode, offset, len);
+}
+
+int sys_sendfile(void) {
+  int outfd, infd, count;
+
+  if(argfd(0, &outfd) == -1 || argfd(1, &infd) == -1
+     || argint(2, &count) == -1)
+    return -1;
+
+  return fsendfile(outfd, infd, count);
+}
+
+int sys_clone_file(void) {
+  int dstfd, srcfd;
+
+  if(argfd(0, &dstfd) == -1 || argfd(1, &srcfd) == -1)
+    return -1;
+
+  return fclone(dstfd, srcfd);
+}
+
+int sys_defrag(void) {
+  uint *before, *after;
+  int fd;
+
+  if(argfd(0, &fd) == -1
+     || argptr(1, (char**) &before, sizeof(uint)) == -1
+     || argptr(2, (char**) &after, sizeof(uint)) == -1)
+    return -1;
+
+  return fdefrag(fd, before, after);
+}
+
+int sys_fiemap(void) {
+  struct fiemap_extent* ext;
+  struct fiemap* fm;
+  int fd, n;
+
+  if(argfd(0, &fd) == -1 || argint(3, &n) == -1 || n < 0
+     || n > 0x7fffffff / (int) sizeof(struct fiemap_extent)
+     || argptr(1, (char**) &fm, sizeof(struct fiemap)) == -1
+     || argptr(2, (char**) &ext, n * sizeof(struct fiemap_extent)) == -1)
+    return -1;
+
+  return ffiemap(fd, fm, ext, n);
+}
+
+int sys_mkdir(void) {
+  char* path;
+
+  if(argstr(0, &path) == -1)
+    return -1;
+
+  return mkdir(path);
+}
+
+int sys_chdir(void) {
+  char* path;
+
+  if(argstr(0, &path) == -1)
+    return -1;
+
+  return chdir(path);
+}
+
+// Fetches and checks the iovec array of readv or writev
+static int argiov(struct iovec** iovp, int* iovcntp) {
+  struct iovec* iov;
+  int i, iovcnt, tot;
+
+  if(argint(2, &iovcnt) == -1 || iovcnt < 0 || iovcnt > IOV_MAX
+     || argptr(1, (char**) &iov, iovcnt * sizeof(struct iovec)) == -1)
+    return -1;
+
+  for(i = 0, tot = 0; i < iovcnt; i++) {
+    if(iov[i].iov_len < 0 || tot + iov[i].iov_len < tot
+       || checkptr((uint64_t) iov[i].iov_base, iov[i].iov_len) == -1)
+      return -1;
+    tot += iov[i].iov_len;
+  }
+
+  *iovp = iov;
+  *iovcntp = iovcnt;
+  return 0;
+}
+
+int sys_readv(void) {
+  struct iovec* iov;
+  int fd, iovcnt;
+
+  if(argfd(0, &fd) == -1 || argiov(&iov, &iovcnt) == -1)
+    return -1;
+
+  return freadv(fd, iov, iovcnt);
+}
+
+int sys_writev(void) {
+  struct iovec* iov;
+  int fd, iovcnt;
+
+  if(argfd(0, &fd) == -1 || argiov(&iov, &iovcnt) == -1)
+    return -1;
+
+  return fwritev(fd, iov, iovcnt);
+}
+
+int sys_mmap(void) {
+  int len, prot, flags, fd, off;
+
+  // The address hint (arg0) is ignored, the kernel picks the address
+  if(argint(1, &len) == -1 || argint(2, &prot) == -1
+     || argint(3, &flags) == -1 || argfd(4, &fd) == -1
+     || argint(5, &off) == -1)
+    return -1;
+
+  return fmmap(fd, len, prot, flags, off);
+}
+
 static int argfd(int argnum, int* retfd) {
 
   int fd;
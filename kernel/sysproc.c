@@ -65,6 +65,19 @@ int sys_sbrk(void) {
   return sbrk(amt);
 }
 
+int sys_munmap(void) {
+  int64_t addr;
+  int len;
+
+  if (argint64(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+
+  if (vspacemunmap(&myproc()->vspace, addr, len) < 0)
+    return -1;
+  vspaceinstall(myproc());
+  return 0;
+}
+
 int sys_sleep(void) {
   int n;
   uint ticks0;
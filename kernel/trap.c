@@ -107,6 +107,12 @@ void trap(struct trap_frame *tf) {
       }
 
 
+      // Pages of mapped files are read in on first touch
+      if (vspacefault(&myproc()->vspace, addr, CHECK_BIT(tf->err, 1)) > 0) {
+        vspaceinstall(myproc());
+        return;
+      }
+
       // Check to see if the fault occurred because we were writing to a read-only field
       // and that read-only field was copy on write
       
@@ -1,9 +1,11 @@
 #include <cdefs.h>
 #include <defs.h>
 #include <elf.h>
+#include <file.h>
 #include <memlayout.h>
 #include <vspace.h>
 #include <proc.h>
+#include <sleeplock.h>
 #include <x86_64.h>
 #include <x86_64vm.h>
 
@@ -135,25 +137,6 @@ vradddata(struct vregion *r, uint64_t va, char *data, int sz, short present, sho
   return 0;
 }
 
-// va must be page aligned
-static int
-vrloaddata(struct vregion *r, uint64_t va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  struct vpage_info *vpi;
-  assertm(va % PGSIZE == 0, "va must be page aligned");
-
-  for (i = 0; i < sz; i += PGSIZE) {
-    vpi = va2vpage_info(r, va + i);
-    assertm(vpi->used, "page must be allocated");
-    n = min(sz - i, (uint) PGSIZE);
-    if (readi(ip, P2V(vpi->ppn << PT_SHIFT), offset + i, n) != n)
-      return -1;
-  }
-
-  return 0;
-}
-
 // Initializes the code region in the given vspace and copies the
 // code in init to the region. Also allocates space for the stack
 // region of 3 pages (3 pages to enable user buffers larger than
@@ -192,19 +175,24 @@ vspaceinitcode(struct vspace *vs, char *init, uint64_t size)
 // loads the code for the given program at 'path' into the
 // vspace for a process. The program must be ELF compliant. The
 // first instruction for the program is returned in the output
-// parameter rip
+// parameter rip. Returns 0, or -1 if the program can't be loaded.
+//
+// Nothing is read but the headers: each page of the code region only
+// records where its bytes are in the file, and vspacefault reads it in
+// the first time it is touched.
 int
 vspaceloadcode(struct vspace *vs, char *path, uint64_t *rip)
 {
   bool first_section = true;
-  int off, sz, i;
-  uint64_t code_end;
+  int off, i;
+  uint64_t code_end, a;
   struct inode *ip;
   struct proghdr ph;
   struct elfhdr elf;
+  struct vpage_info *vpi;
 
   if((ip = namei(path)) == 0){
-    return 0;
+    return -1;
   }
 
   locki(ip);
@@ -227,6 +215,10 @@ vspaceloadcode(struct vspace *vs, char *path, uint64_t *rip)
       goto elf_failure;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto elf_failure;
+    if(ph.vaddr % PGSIZE != 0)
+      goto elf_failure;
+    if(ph.vaddr + ph.memsz >= KERNBASE || ph.off + ph.filesz > ip->size)
+      goto elf_failure;
 
     if (first_section) {
       vs->regions[VR_CODE].va_base = PGROUNDDOWN(ph.vaddr);
@@ -234,37 +226,45 @@ vspaceloadcode(struct vspace *vs, char *path, uint64_t *rip)
     }
 
     // use readelf --sections --program-headers -W <executable> to view the ELF headers and the permissions
-    if((sz = vregionaddmap(&vs->regions[VR_CODE], (uint64_t)ph.vaddr, ph.memsz, VPI_PRESENT, (ph.flags & ELF_PROG_FLAG_WRITE) ? VPI_WRITABLE : VPI_READONLY)) < 0)
-     goto elf_failure;
-    if(ph.vaddr % PGSIZE != 0)
-      goto elf_failure;
+    for(a = 0; a < ph.memsz; a += PGSIZE){
+      if(!(vpi = va2vpage_info(&vs->regions[VR_CODE], ph.vaddr + a)))
+        goto elf_failure;
+      vpi->used = 1;
+      vpi->present = 0;
+      vpi->writable = (ph.flags & ELF_PROG_FLAG_WRITE) ? VPI_WRITABLE : VPI_READONLY;
+      vpi->foff = ph.off + a;
+      // Bytes of the last page past the segment come from the file too,
+      // unless they are bss, so the page can come whole from the page cache
+      if (a + PGSIZE <= ph.filesz || ph.filesz == ph.memsz)
+        vpi->fsz = PGSIZE;
+      else
+        vpi->fsz = a < ph.filesz ? ph.filesz - a : 0;
+    }
 
     code_end = ph.vaddr + ph.memsz;
-
-    if(vrloaddata(&vs->regions[VR_CODE], ph.vaddr, ip, ph.off, ph.filesz) < 0)
-     goto elf_failure;
   }
 
-  assert(!first_section);
+  if (first_section)
+    goto elf_failure;
 
-  // Set code region
+  // Set code region, its pages come from the program file
   vs->regions[VR_CODE].size = code_end - vs->regions[VR_CODE].va_base;
+  vs->regions[VR_CODE].ip = ip;
 
   // Place after code, leave 1 page in between
   vs->regions[VR_HEAP].va_base = PGROUNDUP(code_end) + PGSIZE;
   vs->regions[VR_HEAP].size = 0;
 
   unlocki(ip);
-  irelease(ip);
   *rip = elf.entry;
-  return sz;
+  return 0;
 elf_failure:
   if(ip) {
     unlocki(ip);
     irelease(ip);
   }
 
-  return 0;
+  return -1;
 }
 
 // invalidates the given vspace method in essense remaps the user's virtual
@@ -295,6 +295,9 @@ vspaceupdate(struct vspace *vs)
 
     for (; start < end; start += PGSIZE) {
       vpi = va2vpage_info(vr, start);
+      // Pages of a file not read in yet are left unmapped (see vspacefault)
+      if (!vpi->present)
+        continue;
       mappages(vs->pgtbl, start >> PT_SHIFT, 1, vpi->ppn, x86perms(vpi), 0);
     }
   }
@@ -380,6 +383,8 @@ vspacefree(struct vspace *vs)
 
   for (vr = &vs->regions[0]; vr < &vs->regions[NREGIONS]; vr++) {
     free_page_desc_list(vr->pages);
+    if (vr->ip)
+      irelease(vr->ip);
     memset(vr, 0, sizeof(struct vregion));
   }
 
@@ -487,6 +492,12 @@ copy_vpi_page(struct vpi_page **dst, struct vpi_page *src)
       dstvpi->used = srcvpi->used;
       dstvpi->present = srcvpi->present;
       dstvpi->writable = srcvpi->writable;
+      dstvpi->dirty = srcvpi->dirty;
+      dstvpi->foff = srcvpi->foff;
+      dstvpi->fsz = srcvpi->fsz;
+      // Pages of a file not yet read in have no frame to copy
+      if (!srcvpi->present)
+        continue;
       if (!(data = kalloc()))
         return -1;
       memmove(data, P2V(srcvpi->ppn << PT_SHIFT), PGSIZE);
@@ -497,7 +508,9 @@ copy_vpi_page(struct vpi_page **dst, struct vpi_page *src)
   return copy_vpi_page(&(*dst)->next, src->next);
 }
 
-static int copy_cow_vpi_page(struct vpi_page **dst, struct vpi_page *src) {
+// Pages of a shared region stay shared and writable in both copies
+static int copy_cow_vpi_page(struct vpi_page **dst, struct vpi_page *src,
+                             bool shared) {
 
   int i;
   struct vpage_info *srcvpi, *dstvpi;
@@ -521,7 +534,7 @@ static int copy_cow_vpi_page(struct vpi_page **dst, struct vpi_page *src) {
           // If the frame wasn't read-only then we make it copy on write.
           // If it is read-only, we will never be writing to it anyway so
           // cow doesn't make sense
-          if(srcvpi->writable == VPI_WRITABLE || srcvpi->cow == true) {
+          if(!shared && (srcvpi->writable == VPI_WRITABLE || srcvpi->cow == true)) {
             srcvpi->cow = true;
             srcvpi->writable = VPI_READONLY;
             dstvpi->cow = true;
@@ -532,6 +545,16 @@ static int copy_cow_vpi_page(struct vpi_page **dst, struct vpi_page *src) {
           dstvpi->used = srcvpi->used;
           dstvpi->present = srcvpi->present;
           dstvpi->ppn = srcvpi->ppn;
+          dstvpi->dirty = srcvpi->dirty;
+          dstvpi->foff = srcvpi->foff;
+          dstvpi->fsz = srcvpi->fsz;
+          if(shared)
+            dstvpi->writable = srcvpi->writable;
+
+          // A page of a file not yet read in has no frame
+          if(!srcvpi->present)
+            continue;
+
           // Increment the number of references to the frame (so kfree knows when to delete it)
           acquirekmem();
           struct core_map_entry* frame = (struct core_map_entry *) pa2page(srcvpi->ppn << PT_SHIFT);
@@ -540,7 +563,7 @@ static int copy_cow_vpi_page(struct vpi_page **dst, struct vpi_page *src) {
      }
   }
 
-  return copy_cow_vpi_page(&(*dst)->next, src->next);
+  return copy_cow_vpi_page(&(*dst)->next, src->next, shared);
 }
 
 
@@ -552,6 +575,11 @@ vspacecopy(struct vspace *dst, struct vspace *src)
 
   memmove(dst->regions, src->regions, sizeof(struct vregion) * NREGIONS);
 
+  // The copy maps the same files
+  for (vr = dst->regions; vr < &dst->regions[NREGIONS]; vr++)
+    if (vr->ip)
+      idup(vr->ip);
+
   for (vr = dst->regions; vr < &dst->regions[NREGIONS]; vr++)
     if (copy_vpi_page(&vr->pages, vr->pages) < 0)
       return -1;
@@ -574,8 +602,13 @@ int vspacecowcopy(struct proc *dst_proc, struct proc *src_proc) {
 
   memmove(dst->regions, src->regions, sizeof(struct vregion) * NREGIONS);
 
+  // The copy maps the same files
+  for (vr = dst->regions; vr < &dst->regions[NREGIONS]; vr++)
+    if (vr->ip)
+      idup(vr->ip);
+
   for (vr = dst->regions; vr < &dst->regions[NREGIONS]; vr++)
-    if (copy_cow_vpi_page(&vr->pages, vr->pages) < 0)
+    if (copy_cow_vpi_page(&vr->pages, vr->pages, vr->shared) < 0)
       return -1;
 
   
@@ -648,6 +681,250 @@ vspacewritetova(struct vspace *vs, uint64_t va, char *data, int sz)
   return 0;
 }
 
+// Returns the kernel address of user address va in vs, if the sz bytes at
+// va lie on one present, writable page that is not copy-on-write, so the
+// kernel may fill them through the returned address. Returns 0 otherwise.
+char *
+uva2ka(struct vspace *vs, uint64_t va, int sz)
+{
+  struct vpage_info *vpi;
+  struct vregion *vr;
+
+  if (va % PGSIZE + sz > PGSIZE)
+    return 0;
+  if (!(vr = va2vregion(vs, va)) || !(vpi = va2vpage_info(vr, va)))
+    return 0;
+  if (!vpi->used || !vpi->present || !vpi->writable || vpi->cow)
+    return 0;
+  return (char *)P2V(vpi->ppn << PT_SHIFT) + va % PGSIZE;
+}
+
+// points the page table entry for va in vs at the page described by vpi
+static void
+vspacemappage(struct vspace *vs, uint64_t va, struct vpage_info *vpi)
+{
+  pte_t *pte;
+
+  if (!(pte = walkpml4(vs->pgtbl, (char *)va, 1)))
+    panic("vspacemappage: out of memory");
+  *pte = PTE(vpi->ppn << PT_SHIFT, x86perms(vpi));
+  mark_user_mem(vpi->ppn << PT_SHIFT, va);
+}
+
+// Handles a fault at user address va in vs on a page of a file-backed
+// region. A page not read in yet is read from the file (zero past its fsz
+// bytes or the end of the file),
+// and the first write to a page of a writable shared mapping marks it dirty.
+// Returns 1 if the access can be retried, 0 if the fault is not of this kind
+// and -1 if the page could not be read in. The caller must reinstall the
+// page table if the process is running on it.
+int
+vspacefault(struct vspace *vs, uint64_t va, bool write)
+{
+  struct vregion *vr;
+  struct vpage_info *vpi;
+  struct inode *ip;
+  char *mem;
+  uint n;
+
+  va = PGROUNDDOWN(va);
+  if (!(vr = va2vregion(vs, va)) || !(ip = vr->ip))
+    return 0;
+  if (!(vpi = va2vpage_info(vr, va)) || !vpi->used)
+    return 0;
+
+  if (!vpi->present) {
+    // A kernel fault while the file is locked (say read() into a mapping of
+    // the same file) can't read the page without deadlocking
+    if (holdingsleep(&ip->lock))
+      return -1;
+    locki(ip);
+
+    // A whole page of the file is mapped straight from the page cache and
+    // shared by every process that maps it, so processes running the same
+    // program share its text. A private writable page is shared
+    // copy-on-write until its first write.
+    if (vpi->fsz == PGSIZE && vpi->foff % PGSIZE == 0 &&
+        !(vr->shared && vr->canwrite) && !(write && vpi->writable) &&
+        (mem = imappage(ip, vpi->foff / PGSIZE))) {
+      unlocki(ip);
+      if (vpi->writable) {
+        vpi->writable = VPI_READONLY;
+        vpi->cow = true;
+      }
+      vpi->ppn = PGNUM(V2P(mem));
+      vpi->present = VPI_PRESENT;
+      vspacemappage(vs, va, vpi);
+      return 1;
+    }
+
+    if (!(mem = kalloc())) {
+      unlocki(ip);
+      return -1;
+    }
+    n = 0;
+    if (vpi->foff < ip->size)
+      n = min(ip->size - vpi->foff, (uint)vpi->fsz);
+    if (n > 0 && readi(ip, mem, vpi->foff, n) != n) {
+      unlocki(ip);
+      kfree(mem);
+      return -1;
+    }
+    unlocki(ip);
+    memset(mem + n, 0, PGSIZE - n);
+
+    vpi->ppn = PGNUM(V2P(mem));
+    vpi->present = VPI_PRESENT;
+    vpi->dirty = false;
+  } else if (!write || !vr->shared || !vr->canwrite || vpi->writable) {
+    return 0;
+  }
+
+  // Shared pages stay read-only until written, so only written pages
+  // are written back
+  if (write && vr->shared && vr->canwrite) {
+    vpi->writable = VPI_WRITABLE;
+    vpi->dirty = true;
+  }
+  vspacemappage(vs, va, vpi);
+  return 1;
+}
+
+// whether [va, va + len) is free for a new mapping in vs
+static bool
+mmaprangefree(struct vspace *vs, uint64_t va, uint64_t len)
+{
+  struct vregion *r;
+
+  if (va + len > MMAPTOP)
+    return false;
+  for (r = &vs->regions[VR_MMAP]; r < &vs->regions[NREGIONS]; r++)
+    if (r->size && va < VRTOP(r) && VRBOT(r) < va + len)
+      return false;
+  return true;
+}
+
+// Maps len bytes of ip, starting at file offset off (a multiple of PGSIZE),
+// into vs at an address between MMAPBASE and MMAPTOP. No page is read until
+// it is touched (see vspacefault). Pages are writable if writable; writes
+// reach the file only if shared. Returns the address of the mapping, or 0
+// if vs has no free mmap region or address range.
+uint64_t
+vspacemmap(struct vspace *vs, struct inode *ip, uint off, uint64_t len,
+           bool writable, bool shared)
+{
+  struct vregion *vr, *r;
+  struct vpage_info *vpi;
+  uint64_t va, a;
+
+  len = PGROUNDUP(len);
+  for (vr = &vs->regions[VR_MMAP]; vr < &vs->regions[NREGIONS]; vr++)
+    if (vr->size == 0)
+      break;
+  if (vr == &vs->regions[NREGIONS])
+    return 0;
+
+  // First fit: try MMAPBASE, then the end of each existing mapping
+  va = MMAPBASE;
+  r = &vs->regions[VR_MMAP];
+  while (!mmaprangefree(vs, va, len)) {
+    while (r < &vs->regions[NREGIONS] && r->size == 0)
+      r++;
+    if (r == &vs->regions[NREGIONS])
+      return 0;
+    va = VRTOP(r);
+    r++;
+  }
+
+  vr->dir = VRDIR_UP;
+  vr->va_base = va;
+  for (a = 0; a < len; a += PGSIZE) {
+    if (!(vpi = va2vpage_info(vr, va + a))) {
+      free_page_desc_list(vr->pages);
+      memset(vr, 0, sizeof(struct vregion));
+      return 0;
+    }
+    vpi->used = 1;
+    vpi->present = 0;
+    vpi->writable = (writable && !shared) ? VPI_WRITABLE : VPI_READONLY;
+    vpi->foff = off + a;
+    vpi->fsz = PGSIZE;
+  }
+  vr->size = len;
+  vr->ip = idup(ip);
+  vr->shared = shared;
+  vr->canwrite = writable;
+  return va;
+}
+
+// Writes the dirty pages of vr, if it is a shared mapping, back to its file.
+// Only the part of a page inside the file is written; a mapping never makes
+// a file bigger.
+static void
+vregionsync(struct vregion *vr)
+{
+  struct vpage_info *vpi;
+  uint64_t a;
+  uint n;
+
+  if (!vr->ip || !vr->shared)
+    return;
+
+  locki(vr->ip);
+  for (a = VRBOT(vr); a < VRTOP(vr); a += PGSIZE) {
+    vpi = va2vpage_info(vr, a);
+    if (!vpi->present || !vpi->dirty || vpi->foff >= vr->ip->size)
+      continue;
+    n = min(vr->ip->size - vpi->foff, (uint)PGSIZE);
+    writei(vr->ip, P2V(vpi->ppn << PT_SHIFT), vpi->foff, n);
+    vpi->dirty = false;
+  }
+  unlocki(vr->ip);
+}
+
+// Writes the dirty pages of every shared mapping in vs back to the files.
+// Called before the vspace is freed, since vspacefree may run under a
+// spinlock.
+void
+vspacesync(struct vspace *vs)
+{
+  struct vregion *vr;
+
+  for (vr = &vs->regions[VR_MMAP]; vr < &vs->regions[NREGIONS]; vr++)
+    vregionsync(vr);
+}
+
+// Removes the mapping at va made by vspacemmap, writing its dirty shared
+// pages back first. Only whole mappings can be removed: va must be the
+// address vspacemmap returned and len the length it was given. Returns 0,
+// or -1 if there is no such mapping.
+int
+vspacemunmap(struct vspace *vs, uint64_t va, uint64_t len)
+{
+  struct vregion *vr;
+  struct vpage_info *vpi;
+  uint64_t a;
+
+  for (vr = &vs->regions[VR_MMAP]; vr < &vs->regions[NREGIONS]; vr++)
+    if (vr->size && vr->va_base == va && vr->size == PGROUNDUP(len))
+      break;
+  if (vr == &vs->regions[NREGIONS])
+    return -1;
+
+  vregionsync(vr);
+  for (a = VRBOT(vr); a < VRTOP(vr); a += PGSIZE) {
+    vpi = va2vpage_info(vr, a);
+    if (vpi->present)
+      kfree(P2V(vpi->ppn << PT_SHIFT));
+  }
+  free_page_desc_list(vr->pages);
+  irelease(vr->ip);
+  memset(vr, 0, sizeof(struct vregion));
+
+  vspaceupdate(vs);
+  return 0;
+}
+
 // dumps the first 10 words in the stack starting
 // from the base and moving down 8 bytes at at time.
 void
@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
 
 typedef unsigned long  ulong;
 typedef unsigned int   uint;
@@ -19,20 +20,22 @@ typedef unsigned char  uchar;
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define IPB (BSIZE / sizeof(struct dinode))
+#define IPB (bsize / sizeof(struct dinode))
 #define CONSOLE 1
 
 // Disk layout:
 // [ boot block | sb block | free bit map | inode file start | data blocks ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
+uint bsize = MINBSIZE; // block size, set with -b
+uint fssize;  // Size of the file system in blocks
+int nbitmap;
 int nlog = 80;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
 struct superblock sb;
-char zeroes[BSIZE];
+uchar *img;  // the image, mapped shared from fsfd
 uint freeinode;
 uint freeblock;
 
@@ -77,22 +80,38 @@ main(int argc, char *argv[])
   uint rootino, rootdir_size, rootdir_blocks;
   uint inum, off;
   uint inum_count;
+  uint size, nblks;
   struct dirent de;
-  char buf[BSIZE];
+  char buf[MAXBSIZE];
   struct dinode din;
   struct dinode *root;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 2 && strcmp(argv[1], "-b") == 0){
+    bsize = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-b bsize] fs.img files...\n");
+    exit(1);
+  }
+
+  if(bsize < MINBSIZE || bsize > MAXBSIZE || (bsize & (bsize - 1)) != 0){
+    fprintf(stderr, "mkfs: block size must be a power of 2 from %d to %d\n",
+        MINBSIZE, MAXBSIZE);
     exit(1);
   }
 
-  printf("test: %d", BSIZE % sizeof(struct dinode));
-  assert((BSIZE % sizeof(struct dinode)) == 0);
-  assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert((bsize % sizeof(struct dinode)) == 0);
+  assert((bsize % sizeof(struct dirent)) == 0);
+
+  // The disk is FSSIZE sectors whatever the block size
+  fssize = FSSIZE / (bsize / MINBSIZE);
+  nbitmap = fssize/(bsize*8) + 1;
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -100,29 +119,36 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  // 1 fs block = 1 disk sector
+  // The image starts out as a sparse file of zeros, and blocks are filled
+  // in place through a shared mapping of it
+  if(ftruncate(fsfd, (off_t)fssize * bsize) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
+  img = mmap(0, (size_t)fssize * bsize, PROT_READ|PROT_WRITE, MAP_SHARED, fsfd, 0);
+  if(img == MAP_FAILED){
+    perror("mmap");
+    exit(1);
+  }
+
   nmeta = 2 + nbitmap + nlog;
-  nblocks = FSSIZE - nmeta;
+  nblocks = fssize - nmeta;
 
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
   sb.bmapstart = xint(2);
   sb.logstart = xint(2 + nbitmap);
   sb.inodestart = xint(2 + nbitmap + nlog);
+  sb.bsize = xint(bsize);
 
-  printf("nmeta %d (boot, super, bitmap blocks %u) blocks %d total %d\n",
-       nmeta, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, bitmap blocks %u) blocks %d total %d bsize %d\n",
+       nmeta, nbitmap, nblocks, fssize, bsize);
   freeblock = nmeta;     // the first free block that we can allocate
 
-  // Zeroes out the entire disk
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
-
-
-  // Write superblock in block 2 of disk
+  // Write superblock at byte SBOFF of disk
   memset(buf, 0, sizeof(buf));
-  memmove(buf, &sb, sizeof(sb));
-  wsect(1, buf);
+  memmove(buf + SBOFF % bsize, &sb, sizeof(sb));
+  wsect(SBOFF / bsize, buf);
 
   // Write logheader
   // logheader header;
@@ -130,7 +156,8 @@ main(int argc, char *argv[])
   // memmove(buf, &header, sizeof(header));
   // wsect(sb.logstart, buf);
 
-  inum_count = argc + 1; // argc - 2 files + 1 inode file + 1 root dir + console
+  // argc - 2 files + 1 inode file + 1 root dir + console + refcount file
+  inum_count = argc + 2;
   printf("inum_count %d\n", inum_count);
 
   // Allocate space for the inodefile
@@ -141,7 +168,7 @@ main(int argc, char *argv[])
   rinode(inodefileino, &din);
   din.data[0].startblkno = sb.inodestart;
   inodefileblkn = inum_count/IPB;
-  if (inodefileblkn == 0 || (inum_count * sizeof(struct dinode) % BSIZE))
+  if (inodefileblkn == 0 || (inum_count * sizeof(struct dinode) % bsize))
     inodefileblkn++;
   // Can be put in data index 0 since we are extending it only once here in its creation
   din.data[0].nblocks = xint(inodefileblkn);
@@ -157,8 +184,8 @@ main(int argc, char *argv[])
 
   // argc - 2 directory entries + 2 for '.' and '..' + 1 for console
   rootdir_size = ((argc + 1) * sizeof(struct dirent));
-  rootdir_blocks = rootdir_size / BSIZE;
-	if (rootdir_size % BSIZE)
+  rootdir_blocks = rootdir_size / bsize;
+	if (rootdir_size % bsize)
 		rootdir_blocks += 1;
   iallocblocks(rootino, freeblock, rootdir_blocks);
   freeblock += rootdir_blocks;
@@ -183,6 +210,11 @@ main(int argc, char *argv[])
   strncpy(de.name, "console", DIRSIZ);
   iappend(rootino, &de, sizeof(de));
 
+  // The block reference count file starts out empty, with no directory
+  // entry; the kernel finds it by inum
+  inum = ialloc(T_FILE);
+  assert(inum == REFCNTINO);
+
   for(i = 2; i < argc; i++){
     char *name = argv[i];
 
@@ -210,16 +242,36 @@ main(int argc, char *argv[])
     strncpy(de.name, name, DIRSIZ);
     iappend(rootino, &de, sizeof(de));
 
-    rinode(inum, &din);
-    din.data[0].startblkno = xint(freeblock);
-		winode(inum, &din);
+    // Files no bigger than the extent area are stored inline in the dinode
+    cc = read(fd, buf, INLINESIZE + 1);
+    if(cc >= 0 && cc <= INLINESIZE){
+      rinode(inum, &din);
+      din.flags = xshort(DI_INLINE);
+      din.size = xint(cc);
+      bcopy(buf, din.data, cc);
+      winode(inum, &din);
+      printf("inum: %d name: %s size %d inline\n", inum, name, cc);
+      close(fd);
+      continue;
+    }
 
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
+    // Read the whole file straight into one extent of the image
+    size = lseek(fd, 0, SEEK_END);
+    nblks = (size + bsize - 1) / bsize;
+    if(freeblock + nblks > fssize){
+      fprintf(stderr, "mkfs: no room for %s\n", argv[i]);
+      exit(1);
+    }
+    if(pread(fd, img + (ulong)freeblock * bsize, size, 0) != size){
+      perror(argv[i]);
+      exit(1);
+    }
 
     rinode(inum, &din);
-    din.data[0].nblocks = xint(xint(din.size) / BSIZE + (xint(din.size) % BSIZE == 0 ? 0 : 1));
-    freeblock += xint(din.data[0].nblocks);
+    din.data[0].startblkno = xint(freeblock);
+    din.data[0].nblocks = xint(nblks);
+    din.size = xint(size);
+    freeblock += nblks;
     winode(inum, &din);
 
 		printf("inum: %d name: %s size %d start: %d nblocks: %d\n",
@@ -238,30 +290,28 @@ main(int argc, char *argv[])
 
   balloc(freeblock);
 
+  if(munmap(img, (size_t)fssize * bsize) < 0 || close(fsfd) < 0){
+    perror(argv[1]);
+    exit(1);
+  }
   exit(0);
 }
 
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(write(fsfd, buf, BSIZE) != BSIZE) {
-    perror("write");
-    exit(1);
-  }
+  assert(sec < fssize);
+  memmove(img + (ulong)sec * bsize, buf, bsize);
 }
 
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
+  char buf[MAXBSIZE];
   uint bn;
   struct dinode *dip;
 
-  bn = xint(sb.inodestart) + (INODEOFF(inum) / BSIZE);
+  bn = xint(sb.inodestart) + (INODEOFF(inum) / bsize);
   rsect(bn, buf);
   dip = ((struct dinode*)buf) + (inum % IPB);
   *dip = *ip;
@@ -271,11 +321,11 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
+  char buf[MAXBSIZE];
   uint off, bn;
   struct dinode *dip;
 
-  bn = xint(sb.inodestart) + (INODEOFF(inum) / BSIZE);
+  bn = xint(sb.inodestart) + (INODEOFF(inum) / bsize);
   rsect(bn, buf);
   dip = ((struct dinode*)buf) + (inum % IPB);
   *ip = *dip;
@@ -284,14 +334,8 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
-    perror("read");
-    exit(1);
-  }
+  assert(sec < fssize);
+  memmove(buf, img + (ulong)sec * bsize, bsize);
 }
 
 uint
@@ -312,7 +356,7 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[BSIZE];
+  uchar buf[MAXBSIZE];
   int nbuf = 0;
   int i;
   int remaining = used;
@@ -320,14 +364,14 @@ balloc(int used)
   printf("balloc: first %d blocks have been allocated\n", used);
 
   while (remaining > 0) {
-    bzero(buf, BSIZE);
-    for(i = 0; i < min(remaining, BSIZE*8); i++){
+    bzero(buf, bsize);
+    for(i = 0; i < min(remaining, bsize*8); i++){
       buf[i/8] = buf[i/8] | (0x1 << (i%8));
     }
     printf("balloc: write bitmap block at sector %d\n", sb.bmapstart + nbuf);
     wsect(sb.bmapstart + nbuf, buf);
     nbuf ++;
-    remaining -= BSIZE * 8;
+    remaining -= bsize * 8;
   }
 }
 
@@ -343,24 +387,13 @@ iallocblocks(uint inum, int start, int numblks) {
 void
 iappend(uint inum, void *xp, int n)
 {
-  char *p = (char*)xp;
-  uint fbn, off, n1;
   struct dinode din;
-  char buf[BSIZE];
+  uint off;
 
   rinode(inum, &din);
   off = xint(din.size);
-  printf("append inum %d at off %d sz %d\n", inum, off, n);
-  while(n > 0){
-    fbn = off / BSIZE;
-    n1 = min(n, (fbn + 1) * BSIZE - off);
-    rsect(xint(din.data[0].startblkno) + fbn, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
-    wsect(xint(din.data[0].startblkno) + fbn, buf);
-    n -= n1;
-    off += n1;
-    p += n1;
-  }
-  din.size = xint(off);
+  assert(off + n <= xint(din.data[0].nblocks) * bsize);
+  memmove(img + (ulong)xint(din.data[0].startblkno) * bsize + off, xp, n);
+  din.size = xint(off + n);
   winode(inum, &din);
 }
@@ -0,0 +1,63 @@
+// Measure the file create rate. Creates `n` empty files (default 1000) in
+// the root directory, then unlinks them again, and prints how many clock
+// ticks each phase took. Stops early at the first failed create.
+//
+// usage: createbench [n]
+
+#include <cdefs.h>
+#include <fcntl.h>
+#include <fs.h>
+#include <stat.h>
+#include <user.h>
+
+// Build the name "cb<i>" for the i-th benchmark file.
+static void benchname(char *name, int i) {
+  char digits[8];
+  int n = 0;
+
+  do {
+    digits[n++] = '0' + i % 10;
+    i /= 10;
+  } while (i > 0);
+
+  name[0] = 'c';
+  name[1] = 'b';
+  for (i = 0; i < n; i++)
+    name[2 + i] = digits[n - 1 - i];
+  name[2 + n] = '\0';
+}
+
+int main(int argc, char *argv[]) {
+  char name[DIRSIZ];
+  int n, i, fd, created;
+  uint start, ticks;
+
+  n = 1000;
+  if (argc > 1)
+    n = atoi(argv[1]);
+
+  printf(1, "createbench: creating %d files\n", n);
+
+  start = uptime();
+  for (created = 0; created < n; created++) {
+    benchname(name, created);
+    if ((fd = open(name, O_CREATE | O_RDWR)) < 0) {
+      printf(1, "createbench: create %s failed\n", name);
+      break;
+    }
+    close(fd);
+  }
+  ticks = uptime() - start;
+  printf(1, "createbench: %d creates in %d ticks\n", created, ticks);
+
+  start = uptime();
+  for (i = 0; i < created; i++) {
+    benchname(name, i);
+    if (unlink(name) < 0)
+      printf(1, "createbench: unlink %s failed\n", name);
+  }
+  ticks = uptime() - start;
+  printf(1, "createbench: %d unlinks in %d ticks\n", created, ticks);
+
+  exit();
+}
@@ -0,0 +1,250 @@
+// Tests for subdirectories: mkdir, chdir and relative paths.
+//
+// usage: dirtest
+
+#include <cdefs.h>
+#include <fcntl.h>
+#include <stat.h>
+#include <user.h>
+#include <test.h>
+
+#define NFILE 20   // more entries than fit inline in the directory's dinode
+#define NCHILD 4
+
+// Create path holding the string s
+static void make_file(char *path, char *s) {
+  int fd;
+
+  if ((fd = open(path, O_CREATE | O_RDWR)) < 0)
+    error("make_file: could not create %s", path);
+  if (write(fd, s, strlen(s)) != strlen(s))
+    error("make_file: could not write %s", path);
+  assert(close(fd) == 0);
+}
+
+// Check that path holds the string s
+static void check_file(char *path, char *s) {
+  char buf[32];
+  int fd, n;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    error("check_file: could not open %s", path);
+  if ((n = read(fd, buf, sizeof(buf) - 1)) < 0)
+    error("check_file: could not read %s", path);
+  buf[n] = 0;
+  assert(close(fd) == 0);
+  if (strcmp(buf, s) != 0)
+    error("check_file: %s does not hold '%s'", path, s);
+}
+
+static int stat_type(char *path) {
+  struct stat st;
+
+  if (stat(path, &st) < 0)
+    return -1;
+  return st.type;
+}
+
+void dir_mkdir(void) {
+  test("dir_mkdir");
+
+  assert(mkdir("dirtest.d") == 0);
+  assert(stat_type("dirtest.d") == T_DIR);
+  assert(stat_type("dirtest.d/.") == T_DIR);
+  assert(stat_type("dirtest.d/..") == T_DIR);
+
+  // The name is taken
+  assert(mkdir("dirtest.d") == -1);
+  make_file("dirtest.f", "file");
+  assert(mkdir("dirtest.f") == -1);
+
+  // Every directory along the path must exist
+  assert(mkdir("nonexistent/d") == -1);
+  assert(mkdir("dirtest.f/d") == -1);
+  assert(mkdir("/") == -1);
+
+  make_file("dirtest.d/a", "a");
+  assert(mkdir("dirtest.d/sub") == 0);
+  make_file("/dirtest.d/sub/b", "b");
+  check_file("dirtest.d/sub/b", "b");
+  check_file("dirtest.d/sub/../a", "a");
+  check_file("/dirtest.d/./sub/../../dirtest.f", "file");
+
+  // Names in different directories are distinct
+  make_file("dirtest.d/sub/a", "sub a");
+  check_file("dirtest.d/a", "a");
+  check_file("dirtest.d/sub/a", "sub a");
+  pass("");
+}
+
+void dir_chdir(void) {
+  test("dir_chdir");
+
+  assert(chdir("dirtest.d") == 0);
+  check_file("a", "a");
+  check_file("sub/a", "sub a");
+  check_file("../dirtest.f", "file");
+  check_file("/dirtest.d/sub/b", "b");
+
+  assert(chdir("sub") == 0);
+  check_file("a", "sub a");
+  make_file("c", "c");
+  check_file("/dirtest.d/sub/c", "c");
+
+  // Failed changes leave the current directory alone
+  assert(chdir("nonexistent") == -1);
+  assert(chdir("c") == -1);
+  check_file("a", "sub a");
+
+  assert(chdir("../..") == 0);
+  check_file("dirtest.f", "file");
+  assert(chdir("/dirtest.d/sub") == 0);
+  check_file("b", "b");
+  assert(chdir("/") == 0);
+  pass("");
+}
+
+void dir_fork(void) {
+  test("dir_fork");
+
+  int pid;
+
+  // A child starts in its parent's directory, and its chdir is its own
+  assert(chdir("dirtest.d") == 0);
+  if ((pid = fork()) == 0) {
+    check_file("a", "a");
+    assert(chdir("sub") == 0);
+    check_file("a", "sub a");
+    exit();
+  }
+  assert(wait() == pid);
+  check_file("a", "a");
+  assert(chdir("..") == 0);
+  pass("");
+}
+
+void dir_many(void) {
+  test("dir_many");
+
+  char name[] = "dirtest.d/many/fA";
+  char *p = name + strlen(name) - 1;
+  int i;
+
+  // Grow a directory past its inline area
+  assert(mkdir("dirtest.d/many") == 0);
+  for (i = 0; i < NFILE; i++) {
+    *p = 'A' + i;
+    make_file(name, p);
+  }
+  for (i = 0; i < NFILE; i++) {
+    *p = 'A' + i;
+    check_file(name, p);
+  }
+
+  // Removed slots are reused
+  for (i = 0; i < NFILE; i += 2) {
+    *p = 'A' + i;
+    assert(unlink(name) == 0);
+  }
+  for (i = 0; i < NFILE; i += 2) {
+    *p = 'a' + i;
+    make_file(name, p);
+  }
+  for (i = 0; i < NFILE; i++) {
+    *p = (i % 2 ? 'A' : 'a') + i;
+    check_file(name, p);
+  }
+  pass("");
+}
+
+void dir_concurrent(void) {
+  test("dir_concurrent");
+
+  char dir[] = "dirtest.d/cA";
+  char file[] = "dirtest.d/cA/fA";
+  int i, j;
+
+  // Each child fills its own directory
+  for (i = 0; i < NCHILD; i++) {
+    dir[strlen(dir) - 1] = 'A' + i;
+    assert(mkdir(dir) == 0);
+  }
+  for (i = 0; i < NCHILD; i++) {
+    if (fork() == 0) {
+      file[strlen(dir) - 1] = 'A' + i;
+      for (j = 0; j < NFILE; j++) {
+        file[strlen(file) - 1] = 'A' + j;
+        make_file(file, file + strlen(dir) + 1);
+      }
+      exit();
+    }
+  }
+  for (i = 0; i < NCHILD; i++)
+    assert(wait() > 0);
+
+  for (i = 0; i < NCHILD; i++) {
+    file[strlen(dir) - 1] = 'A' + i;
+    for (j = 0; j < NFILE; j++) {
+      file[strlen(file) - 1] = 'A' + j;
+      check_file(file, file + strlen(dir) + 1);
+      assert(unlink(file) == 0);
+    }
+  }
+  pass("");
+}
+
+void dir_unlink(void) {
+  test("dir_unlink");
+
+  char name[] = "dirtest.d/many/fA";
+  char *p = name + strlen(name) - 1;
+  char dir[] = "dirtest.d/cA";
+  int i;
+
+  // A directory is only removed once it is empty
+  assert(unlink("dirtest.d") == -1);
+  assert(unlink("dirtest.d/sub") == -1);
+  assert(unlink("dirtest.d/sub/.") == -1);
+  assert(unlink("dirtest.d/sub/..") == -1);
+  assert(unlink("dirtest.d/sub/a") == 0);
+  assert(unlink("dirtest.d/sub/b") == 0);
+  assert(unlink("dirtest.d/sub/c") == 0);
+
+  // Not while it is some process's current directory
+  assert(chdir("dirtest.d/sub") == 0);
+  assert(unlink("/dirtest.d/sub") == -1);
+  assert(chdir("/") == 0);
+  assert(unlink("dirtest.d/sub") == 0);
+  assert(stat_type("dirtest.d/sub") == -1);
+  assert(chdir("dirtest.d/sub") == -1);
+
+  // The name can be used again
+  assert(mkdir("dirtest.d/sub") == 0);
+  assert(stat_type("dirtest.d/sub/a") == -1);
+  assert(unlink("dirtest.d/sub") == 0);
+
+  for (i = 0; i < NFILE; i++) {
+    *p = (i % 2 ? 'A' : 'a') + i;
+    assert(unlink(name) == 0);
+  }
+  assert(unlink("dirtest.d/many") == 0);
+  for (i = 0; i < NCHILD; i++) {
+    dir[strlen(dir) - 1] = 'A' + i;
+    assert(unlink(dir) == 0);
+  }
+  assert(unlink("dirtest.d/a") == 0);
+  assert(unlink("dirtest.d") == 0);
+  assert(unlink("dirtest.f") == 0);
+  pass("");
+}
+
+int main(int argc, char *argv[]) {
+  dir_mkdir();
+  dir_chdir();
+  dir_fork();
+  dir_many();
+  dir_concurrent();
+  dir_unlink();
+  pass("dir tests");
+  exit();
+}
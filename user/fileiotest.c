@@ -0,0 +1,687 @@
+// Tests for the positional and vectored file I/O calls, for changing the
+// size of a file, for sparse files, sendfile, clone_file, defrag and fiemap.
+//
+// usage: fileiotest
+
+#include <cdefs.h>
+#include <fcntl.h>
+#include <stat.h>
+#include <uio.h>
+#include <user.h>
+#include <test.h>
+
+#define FILESZ 5000
+
+// defrag_test writes in chunks a whole block at the largest block size
+#define CHUNK 4096
+#define NCHUNK 8
+#define NEXT (2 * NCHUNK)
+
+#define NJUNK 16 // FILESZ chunks written by dirty_free_blocks
+
+#define NCLONE 10 // clones of one file in clone_many_test
+#define NRACE 50  // rounds of clone_many_test's race
+
+char buf[FILESZ];
+char buf2[FILESZ];
+
+// Create fileiotest.tmp holding FILESZ bytes of a known pattern
+static int make_file(void) {
+  int fd, i;
+
+  for (i = 0; i < FILESZ; i++)
+    buf[i] = i % 253;
+  unlink("fileiotest.tmp");
+  if ((fd = open("fileiotest.tmp", O_CREATE | O_RDWR)) < 0)
+    error("make_file: could not create fileiotest.tmp");
+  if (write(fd, buf, FILESZ) != FILESZ)
+    error("make_file: could not write fileiotest.tmp");
+  assert(close(fd) == 0);
+  return open("fileiotest.tmp", O_RDWR);
+}
+
+// Leave nonzero bytes in free disk blocks, by writing a file of them and
+// removing it, so tests can tell a block that was zeroed from one that
+// still holds what a freed block held
+static void dirty_free_blocks(void) {
+  int fd, i;
+
+  memset(buf2, 'j', FILESZ);
+  unlink("fileiotest.junk");
+  fd = open("fileiotest.junk", O_CREATE | O_RDWR);
+  assert(fd >= 0);
+  for (i = 0; i < NJUNK; i++)
+    assert(write(fd, buf2, FILESZ) == FILESZ);
+  assert(close(fd) == 0);
+  assert(unlink("fileiotest.junk") == 0);
+}
+
+// Check that bytes [off, off + n) of fd read as zeros
+static void check_zeros(int fd, int off, int n) {
+  int i, m;
+
+  for (; n > 0; off += m, n -= m) {
+    m = n < FILESZ ? n : FILESZ;
+    assert(pread(fd, buf2, m, off) == m);
+    for (i = 0; i < m; i++)
+      if (buf2[i] != 0)
+        error("check_zeros: byte %d is not zero", off + i);
+  }
+}
+
+void lseek_test(void) {
+  test("lseek_test");
+
+  int fd;
+  char c;
+
+  fd = make_file();
+  assert(lseek(fd, 1000, SEEK_SET) == 1000);
+  assert(read(fd, &c, 1) == 1 && c == (char)(1000 % 253));
+  assert(lseek(fd, 10, SEEK_CUR) == 1011);
+  assert(read(fd, &c, 1) == 1 && c == (char)(1011 % 253));
+  assert(lseek(fd, -1, SEEK_END) == FILESZ - 1);
+  assert(read(fd, &c, 1) == 1 && c == (char)((FILESZ - 1) % 253));
+  assert(read(fd, &c, 1) == 0);
+
+  // A write at the new position overwrites in place
+  assert(lseek(fd, 2, SEEK_SET) == 2);
+  assert(write(fd, "xy", 2) == 2);
+  assert(lseek(fd, 0, SEEK_SET) == 0);
+  assert(read(fd, buf2, 4) == 4);
+  assert(buf2[0] == 0 && buf2[1] == 1 && buf2[2] == 'x' && buf2[3] == 'y');
+
+  assert(lseek(fd, -1, SEEK_SET) == -1);
+  assert(lseek(fd, 0, 7) == -1);
+  assert(close(fd) == 0);
+  pass("");
+}
+
+void pread_pwrite_test(void) {
+  test("pread_pwrite_test");
+
+  int fd, i;
+
+  fd = make_file();
+  assert(lseek(fd, 100, SEEK_SET) == 100);
+
+  assert(pread(fd, buf2, 300, 4000) == 300);
+  for (i = 0; i < 300; i++)
+    if (buf2[i] != (char)((4000 + i) % 253))
+      error("pread_pwrite_test: byte %d read wrong", 4000 + i);
+
+  // Reads are cut short at the end of the file
+  assert(pread(fd, buf2, 300, FILESZ - 10) == 10);
+  assert(pread(fd, buf2, 300, FILESZ) == 0);
+
+  // pwrite overwrites and appends
+  assert(pwrite(fd, "abc", 3, 10) == 3);
+  assert(pwrite(fd, "end", 3, FILESZ) == 3);
+  assert(pread(fd, buf2, 3, 10) == 3 && buf2[0] == 'a' && buf2[2] == 'c');
+  assert(pread(fd, buf2, 3, FILESZ) == 3 && buf2[0] == 'e' && buf2[2] == 'd');
+
+  // Neither moved the offset
+  assert(lseek(fd, 0, SEEK_CUR) == 100);
+  assert(pread(fd, buf2, 1, -1) == -1);
+  assert(close(fd) == 0);
+  pass("");
+}
+
+void readv_writev_test(void) {
+  test("readv_writev_test");
+
+  int fd, i;
+  struct iovec iov[3];
+  char a[10], b[1], c[3000];
+
+  fd = make_file();
+
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = 0;
+  iov[2].iov_base = c;
+  iov[2].iov_len = sizeof(c);
+  assert(readv(fd, iov, 3) == sizeof(a) + sizeof(c));
+  assert(a[9] == 9 && c[0] == 10);
+  for (i = 0; i < sizeof(c); i++)
+    if (c[i] != (char)((10 + i) % 253))
+      error("readv_writev_test: byte %d read wrong", 10 + i);
+
+  // The last buffer is cut short at the end of the file
+  assert(readv(fd, iov, 3) == FILESZ - sizeof(a) - sizeof(c));
+
+  // writev appends the buffers in order
+  strcpy(a, "012345678");
+  strcpy(c, "abc");
+  iov[2].iov_len = 3;
+  assert(writev(fd, iov, 3) == sizeof(a) + 3);
+  assert(pread(fd, buf2, 13, FILESZ) == 13);
+  if (strcmp(buf2, "012345678") != 0 || buf2[10] != 'a' || buf2[12] != 'c')
+    error("readv_writev_test: writev wrote the wrong bytes");
+
+  iov[0].iov_len = -1;
+  assert(readv(fd, iov, 3) == -1);
+  assert(readv(fd, iov, 1000) == -1);
+  assert(close(fd) == 0);
+  pass("");
+}
+
+void ftruncate_test(void) {
+  test("ftruncate_test");
+
+  int fd, i;
+  struct stat st;
+
+  fd = make_file();
+  assert(ftruncate(fd, 1000) == 0);
+  assert(fstat(fd, &st) == 0 && st.size == 1000);
+  assert(pread(fd, buf2, FILESZ, 0) == 1000);
+  for (i = 0; i < 1000; i++)
+    if (buf2[i] != (char)(i % 253))
+      error("ftruncate_test: byte %d changed by shrinking", i);
+
+  // Growing again reads back zeros, not the old bytes
+  assert(ftruncate(fd, FILESZ) == 0);
+  assert(pread(fd, buf2, FILESZ, 0) == FILESZ);
+  assert(buf2[999] == (char)(999 % 253));
+  for (i = 1000; i < FILESZ; i++)
+    if (buf2[i] != 0)
+      error("ftruncate_test: byte %d is not zero after growing", i);
+
+  // Freed blocks are reused; a leak would fill the disk
+  for (i = 0; i < 40; i++) {
+    assert(ftruncate(fd, 0) == 0);
+    assert(pwrite(fd, buf, FILESZ, 0) == FILESZ);
+  }
+  assert(ftruncate(fd, -1) == -1);
+  assert(close(fd) == 0);
+
+  fd = open("fileiotest.tmp", O_RDONLY);
+  assert(ftruncate(fd, 0) == -1);
+  assert(close(fd) == 0);
+  pass("");
+}
+
+void fallocate_test(void) {
+  test("fallocate_test");
+
+  int fd, i;
+  struct stat st;
+
+  fd = make_file();
+
+  // Reserved blocks past the end leave the size alone until written
+  assert(fallocate(fd, FALLOC_FL_KEEP_SIZE, FILESZ, 8000) == 0);
+  assert(fstat(fd, &st) == 0 && st.size == FILESZ);
+  assert(pwrite(fd, buf, 3000, FILESZ) == 3000);
+  assert(fstat(fd, &st) == 0 && st.size == FILESZ + 3000);
+  assert(pread(fd, buf2, 3000, FILESZ) == 3000);
+  for (i = 0; i < 3000; i++)
+    if (buf2[i] != buf[i])
+      error("fallocate_test: byte %d of reserved blocks read wrong", i);
+
+  // Without FALLOC_FL_KEEP_SIZE the file grows with zeros
+  assert(fallocate(fd, 0, 0, FILESZ + 4000) == 0);
+  assert(fstat(fd, &st) == 0 && st.size == FILESZ + 4000);
+  assert(pread(fd, buf2, 1000, FILESZ + 3000) == 1000);
+  for (i = 0; i < 1000; i++)
+    if (buf2[i] != 0)
+      error("fallocate_test: byte %d is not zero", FILESZ + 3000 + i);
+
+  // ftruncate drops the reserved blocks too
+  assert(ftruncate(fd, 100) == 0);
+  assert(fstat(fd, &st) == 0 && st.size == 100);
+
+  // Reserved blocks that a write past them brings inside the file read as
+  // zeros, not as whatever the disk held
+  dirty_free_blocks();
+  assert(fallocate(fd, FALLOC_FL_KEEP_SIZE, 100, 8000) == 0);
+  assert(pwrite(fd, "x", 1, 9000) == 1);
+  assert(fstat(fd, &st) == 0 && st.size == 9001);
+  check_zeros(fd, 100, 9000 - 100);
+  assert(ftruncate(fd, 100) == 0);
+
+  assert(fallocate(fd, 2, 0, 100) == -1);
+  assert(fallocate(fd, 0, -1, 100) == -1);
+  assert(fallocate(fd, 0, 0, 0) == -1);
+  assert(close(fd) == 0);
+  pass("");
+}
+
+void hole_test(void) {
+  test("hole_test");
+
+  int fd, i, off;
+  struct stat st;
+  char c;
+
+  fd = make_file();
+
+  // Seeking past the end and writing leaves a hole of zeros
+  assert(lseek(fd, 100000, SEEK_SET) == 100000);
+  assert(write(fd, "x", 1) == 1);
+  assert(fstat(fd, &st) == 0 && st.size == 100001);
+  assert(pread(fd, buf2, FILESZ, FILESZ - 10) == FILESZ);
+  for (i = 0; i < 10; i++)
+    if (buf2[i] != (char)((FILESZ - 10 + i) % 253))
+      error("hole_test: byte %d before the hole changed", FILESZ - 10 + i);
+  for (; i < FILESZ; i++)
+    if (buf2[i] != 0)
+      error("hole_test: byte %d in the hole is not zero", FILESZ - 10 + i);
+  assert(pread(fd, &c, 1, 100000) == 1 && c == 'x');
+
+  // Writing into the middle of the hole fills just that part
+  assert(pwrite(fd, buf, FILESZ, 50000) == FILESZ);
+  assert(pread(fd, buf2, FILESZ, 50000) == FILESZ);
+  for (i = 0; i < FILESZ; i++)
+    if (buf2[i] != buf[i])
+      error("hole_test: byte %d written into the hole is wrong", 50000 + i);
+  assert(pread(fd, &c, 1, 49999) == 1 && c == 0);
+  assert(pread(fd, &c, 1, 50000 + FILESZ) == 1 && c == 0);
+
+  // Many small writes into holes split the extent tree's nodes
+  for (i = 0; i < 200; i++)
+    assert(pwrite(fd, &i, 1, 60000 + i * 150) == 1);
+  for (i = 0; i < 200; i++)
+    if (pread(fd, &c, 1, 60000 + i * 150) != 1 || c != (char)i)
+      error("hole_test: small write %d read back wrong", i);
+
+  // Reads past the end return nothing
+  assert(lseek(fd, 200000, SEEK_SET) == 200000);
+  assert(read(fd, &c, 1) == 0);
+
+  // A hole at the end made by ftruncate
+  assert(ftruncate(fd, 300000) == 0);
+  assert(pread(fd, &c, 1, 299999) == 1 && c == 0);
+
+  // Growing and shrinking when the end of the file is in a hole
+  assert(ftruncate(fd, 310000) == 0);
+  assert(pread(fd, &c, 1, 305000) == 1 && c == 0);
+  assert(ftruncate(fd, 250000) == 0);
+  assert(fstat(fd, &st) == 0 && st.size == 250000);
+  assert(pread(fd, &c, 1, 249999) == 1 && c == 0);
+  assert(pread(fd, &c, 1, 100000) == 1 && c == 'x');
+  assert(close(fd) == 0);
+
+  unlink("fileiotest.out");
+  fd = open("fileiotest.out", O_CREATE | O_RDWR);
+  assert(fd >= 0);
+  assert(ftruncate(fd, 1000) == 0);
+  assert(ftruncate(fd, 2000) == 0);
+  assert(pread(fd, &c, 1, 1500) == 1 && c == 0);
+  assert(pwrite(fd, "x", 1, 10000) == 1);
+  assert(ftruncate(fd, 5000) == 0);
+  assert(fstat(fd, &st) == 0 && st.size == 5000);
+  assert(pread(fd, &c, 1, 4999) == 1 && c == 0);
+  assert(ftruncate(fd, 12000) == 0);
+  assert(pread(fd, &c, 1, 10000) == 1 && c == 0);
+
+  // Small writes into a hole get blocks that once belonged to another
+  // file; the bytes around them must still read as zeros
+  assert(ftruncate(fd, 0) == 0);
+  assert(pwrite(fd, "x", 1, 40000) == 1);
+  dirty_free_blocks();
+  for (i = 0; i < 8; i++)
+    assert(pwrite(fd, "ab", 2, 1000 + i * 4500) == 2);
+  for (i = 0, off = 0; i < 8; i++) {
+    check_zeros(fd, off, 1000 + i * 4500 - off);
+    off = 1000 + i * 4500;
+    assert(pread(fd, buf2, 2, off) == 2 && buf2[0] == 'a' && buf2[1] == 'b');
+    off += 2;
+  }
+  check_zeros(fd, off, 40000 - off);
+  assert(close(fd) == 0);
+  assert(unlink("fileiotest.out") == 0);
+  pass("");
+}
+
+// Check that the first n bytes of path hold the make_file pattern
+static void check_copy(char *path, int n) {
+  int fd, i;
+
+  fd = open(path, O_RDONLY);
+  assert(fd >= 0);
+  assert(read(fd, buf2, FILESZ) == n);
+  for (i = 0; i < n; i++)
+    if (buf2[i] != (char)(i % 253))
+      error("sendfile_test: byte %d of %s copied wrong", i, path);
+  assert(close(fd) == 0);
+}
+
+void sendfile_test(void) {
+  test("sendfile_test");
+
+  int fd, out, pid, p[2];
+
+  // File to file, stopping at the end of the input
+  fd = make_file();
+  unlink("fileiotest.out");
+  out = open("fileiotest.out", O_CREATE | O_RDWR);
+  assert(out >= 0);
+  assert(sendfile(out, fd, 1000) == 1000);
+  assert(sendfile(out, fd, FILESZ) == FILESZ - 1000);
+  assert(sendfile(out, fd, FILESZ) == 0);
+  assert(lseek(out, 0, SEEK_CUR) == FILESZ);
+  assert(close(out) == 0);
+  check_copy("fileiotest.out", FILESZ);
+
+  // File to pipe to file
+  assert(lseek(fd, 0, SEEK_SET) == 0);
+  assert(pipe(p) == 0);
+  if ((pid = fork()) == 0) {
+    close(p[0]);
+    if (sendfile(p[1], fd, FILESZ) != FILESZ)
+      error("sendfile_test: sendfile into a pipe failed");
+    exit();
+  }
+  assert(close(p[1]) == 0);
+  assert(unlink("fileiotest.out") == 0);
+  out = open("fileiotest.out", O_CREATE | O_RDWR);
+  assert(out >= 0);
+  assert(sendfile(out, p[0], 2 * FILESZ) == FILESZ);
+  wait();
+  assert(close(p[0]) == 0);
+  assert(close(out) == 0);
+  check_copy("fileiotest.out", FILESZ);
+
+  assert(sendfile(fd, fd, -1) == -1);
+  assert(sendfile(fd, 20, 1) == -1);
+  assert(close(fd) == 0);
+  assert(unlink("fileiotest.out") == 0);
+  pass("");
+}
+
+void clone_test(void) {
+  test("clone_test");
+
+  int fd, cl, i;
+  struct stat st;
+
+  fd = make_file();
+  unlink("fileiotest.out");
+  cl = open("fileiotest.out", O_CREATE | O_RDWR);
+  assert(cl >= 0);
+  assert(write(cl, "old", 3) == 3);
+  assert(clone_file(cl, fd) == 0);
+  assert(fstat(cl, &st) == 0 && st.size == FILESZ);
+  assert(close(cl) == 0);
+  check_copy("fileiotest.out", FILESZ);
+
+  // Writes to either file stay in that file
+  cl = open("fileiotest.out", O_RDWR);
+  assert(pwrite(fd, "src", 3, 1000) == 3);
+  assert(pwrite(cl, "dst", 3, 2000) == 3);
+  assert(pread(fd, buf2, 3, 2000) == 3);
+  assert(buf2[0] == (char)(2000 % 253));
+  assert(pread(cl, buf2, FILESZ, 0) == FILESZ);
+  for (i = 0; i < FILESZ; i++) {
+    if (i >= 2000 && i < 2003)
+      continue;
+    if (buf2[i] != (char)(i % 253))
+      error("clone_test: byte %d of the clone changed", i);
+  }
+  assert(buf2[2000] == 'd' && buf2[2002] == 't');
+
+  // Shrinking the source leaves the clone whole
+  assert(ftruncate(fd, 10) == 0);
+  assert(pread(cl, buf2, FILESZ, 0) == FILESZ);
+  assert(buf2[100] == 100 && buf2[FILESZ - 1] == (char)((FILESZ - 1) % 253));
+
+  // A clone of a clone, then free them all
+  assert(clone_file(fd, cl) == 0);
+  assert(pread(fd, buf2, 3, 2000) == 3 && buf2[0] == 'd');
+  assert(clone_file(fd, fd) == -1);
+  assert(close(cl) == 0);
+  assert(unlink("fileiotest.out") == 0);
+  assert(pread(fd, buf2, FILESZ, 0) == FILESZ);
+  assert(buf2[100] == 100 && buf2[2001] == 's');
+  assert(close(fd) == 0);
+  pass("");
+}
+
+void clone_many_test(void) {
+  test("clone_many_test");
+
+  char name[] = "fileiotest.cA";
+  int fd, cl, out, i, pid;
+
+  // Many clones of one file take and drop many references to its blocks
+  fd = make_file();
+  for (i = 0; i < NCLONE; i++) {
+    name[strlen(name) - 1] = 'A' + i;
+    unlink(name);
+    cl = open(name, O_CREATE | O_RDWR);
+    assert(cl >= 0);
+    assert(clone_file(cl, fd) == 0);
+    assert(close(cl) == 0);
+  }
+  for (i = 0; i < NCLONE; i += 2) {
+    name[strlen(name) - 1] = 'A' + i;
+    assert(unlink(name) == 0);
+  }
+  assert(ftruncate(fd, 0) == 0);
+  for (i = 1; i < NCLONE; i += 2) {
+    name[strlen(name) - 1] = 'A' + i;
+    check_copy(name, FILESZ);
+  }
+
+  // Freeing blocks of a shared file while another process clones: the
+  // truncate frees through the bitmap as the clone takes references
+  name[strlen(name) - 1] = 'B';
+  cl = open(name, O_RDWR);
+  assert(cl >= 0);
+  unlink("fileiotest.out");
+  out = open("fileiotest.out", O_CREATE | O_RDWR);
+  assert(out >= 0);
+  if ((pid = fork()) == 0) {
+    for (i = 0; i < NRACE; i++)
+      assert(clone_file(out, cl) == 0);
+    exit();
+  }
+  for (i = 0; i < NRACE; i++) {
+    assert(pwrite(cl, buf, FILESZ, FILESZ) == FILESZ);
+    assert(ftruncate(cl, FILESZ) == 0);
+  }
+  assert(wait() == pid);
+  assert(close(cl) == 0);
+  assert(close(out) == 0);
+  check_copy("fileiotest.out", FILESZ);
+  assert(unlink("fileiotest.out") == 0);
+
+  for (i = 1; i < NCLONE; i += 2) {
+    name[strlen(name) - 1] = 'A' + i;
+    assert(unlink(name) == 0);
+  }
+  assert(close(fd) == 0);
+  pass("");
+}
+
+// Check that the n chunks of CHUNK bytes of fd from off each hold the
+// first CHUNK bytes of the make_file pattern
+static void check_chunks(int fd, int off, int n) {
+  int i, j;
+
+  for (i = 0; i < n; i++) {
+    assert(pread(fd, buf2, CHUNK, off + i * CHUNK) == CHUNK);
+    for (j = 0; j < CHUNK; j++)
+      if (buf2[j] != buf[j])
+        error("defrag_test: byte %d moved wrong", off + i * CHUNK + j);
+  }
+}
+
+void defrag_test(void) {
+  test("defrag_test");
+
+  int fd, out, cl, i, pid;
+  uint before, after;
+  char c;
+
+  // Appending to two files in turn interleaves their blocks
+  fd = make_file();
+  assert(ftruncate(fd, 0) == 0);
+  unlink("fileiotest.out");
+  out = open("fileiotest.out", O_CREATE | O_RDWR);
+  assert(out >= 0);
+  for (i = 0; i < NCHUNK; i++) {
+    assert(write(fd, buf, CHUNK) == CHUNK);
+    assert(write(out, buf, CHUNK) == CHUNK);
+  }
+
+  assert(defrag(fd, &before, &after) == 0);
+  if (before < 2 || after != 1)
+    error("defrag_test: %d extents became %d", before, after);
+  check_chunks(fd, 0, NCHUNK);
+  assert(defrag(fd, &before, &after) == 0);
+  assert(before == 1 && after == 1);
+
+  // Blocks allocated by another process while defrag copies stay out of
+  // the run it reserved
+  if ((pid = fork()) == 0) {
+    unlink("fileiotest.c");
+    cl = open("fileiotest.c", O_CREATE | O_RDWR);
+    assert(cl >= 0);
+    for (i = 0; i < NCHUNK; i++)
+      assert(write(cl, buf, CHUNK) == CHUNK);
+    assert(close(cl) == 0);
+    exit();
+  }
+  for (i = 0; i < NCHUNK; i++) {
+    assert(write(fd, buf, CHUNK) == CHUNK);
+    assert(defrag(fd, &before, &after) == 0);
+  }
+  assert(wait() == pid);
+  check_chunks(fd, 0, 2 * NCHUNK);
+  cl = open("fileiotest.c", O_RDONLY);
+  assert(cl >= 0);
+  check_chunks(cl, 0, NCHUNK);
+  assert(close(cl) == 0);
+  assert(unlink("fileiotest.c") == 0);
+  assert(ftruncate(fd, NCHUNK * CHUNK) == 0);
+
+  // A sparse file keeps its hole
+  assert(pwrite(out, buf, CHUNK, 100000) == CHUNK);
+  assert(defrag(out, &before, &after) == 0);
+  if (after != 2)
+    error("defrag_test: sparse file has %d extents, expected 2", after);
+  check_chunks(out, 0, NCHUNK);
+  check_chunks(out, 100000, 1);
+  assert(pread(out, &c, 1, 99999) == 1 && c == 0);
+
+  // Blocks shared with a clone stay put, and so do directories
+  assert(clone_file(out, fd) == 0);
+  assert(defrag(out, &before, &after) == -1);
+  assert(close(out) == 0);
+  assert(unlink("fileiotest.out") == 0);
+  out = open(".", O_RDONLY);
+  assert(defrag(out, &before, &after) == -1);
+  assert(close(out) == 0);
+  assert(close(fd) == 0);
+  pass("");
+}
+
+// Check that the n extents in ext are in file block order, without overlap,
+// and map all of the blocks fm counts
+static void check_extents(struct fiemap *fm, struct fiemap_extent *ext, int n) {
+  uint nblocks;
+  int i;
+
+  if (n != fm->nextents)
+    error("fiemap_test: got %d extents of %d", n, fm->nextents);
+  for (i = 0, nblocks = 0; i < n; i++) {
+    if (ext[i].nblocks == 0 || ext[i].blkno == 0)
+      error("fiemap_test: extent %d is empty", i);
+    if (i > 0 && ext[i].fbn < ext[i - 1].fbn + ext[i - 1].nblocks)
+      error("fiemap_test: extent %d overlaps the one before", i);
+    nblocks += ext[i].nblocks;
+  }
+  if (nblocks != fm->nblocks)
+    error("fiemap_test: extents map %d blocks, not %d", nblocks, fm->nblocks);
+}
+
+void fiemap_test(void) {
+  test("fiemap_test");
+
+  struct fiemap fm;
+  struct fiemap_extent ext[NEXT];
+  struct stat st;
+  int fd, out, n, p[2];
+  uint before, after;
+
+  // A small file is stored in its inode
+  unlink("fileiotest.out");
+  out = open("fileiotest.out", O_CREATE | O_RDWR);
+  assert(out >= 0);
+  assert(write(out, buf, 10) == 10);
+  assert(fiemap(out, &fm, ext, NEXT) == 0);
+  assert(fm.flags == FIEMAP_INLINE && fm.size == 10);
+  assert(fm.nextents == 0 && fm.nblocks == 0 && fm.nfrags == 0);
+
+  // Appending to two files in turn fragments both
+  fd = make_file();
+  assert(ftruncate(fd, 0) == 0);
+  assert(ftruncate(out, 0) == 0);
+  for (n = 0; n < NCHUNK; n++) {
+    assert(write(fd, buf, CHUNK) == CHUNK);
+    assert(write(out, buf, CHUNK) == CHUNK);
+  }
+  n = fiemap(fd, &fm, ext, NEXT);
+  check_extents(&fm, ext, n);
+  assert(fm.size == NCHUNK * CHUNK && fm.nblocks * fm.bsize == fm.size);
+  assert(ext[0].fbn == 0 && !(fm.flags & FIEMAP_INLINE));
+  if (fm.nfrags < 2 || fm.nfrags > fm.nextents)
+    error("fiemap_test: %d extents in %d fragments", fm.nextents, fm.nfrags);
+
+  // Only as many extents as there is room for are copied
+  assert(fiemap(fd, &fm, ext, 1) == 1 && fm.nextents == n);
+  assert(fiemap(fd, &fm, ext, 0) == 0 && fm.nextents == n);
+
+  // defrag leaves one extent, and a hole ends it
+  assert(defrag(fd, &before, &after) == 0 && before == n);
+  n = fiemap(fd, &fm, ext, NEXT);
+  check_extents(&fm, ext, n);
+  assert(n == 1 && fm.nfrags == 1);
+  assert(pwrite(fd, buf, CHUNK, 4 * NCHUNK * CHUNK) == CHUNK);
+  n = fiemap(fd, &fm, ext, NEXT);
+  check_extents(&fm, ext, n);
+  assert(n == 2 && ext[1].fbn * fm.bsize == 4 * NCHUNK * CHUNK);
+  assert(fm.nblocks * fm.bsize == (NCHUNK + 1) * CHUNK);
+
+  // A clone shares the blocks of its source
+  assert(clone_file(out, fd) == 0);
+  assert(fiemap(out, &fm, ext, NEXT) == 2 && (fm.flags & FIEMAP_SHARED));
+  assert(close(out) == 0);
+  assert(unlink("fileiotest.out") == 0);
+
+  // Directories have a layout too, pipes and devices do not
+  out = open(".", O_RDONLY);
+  assert(fstat(out, &st) == 0);
+  assert(fiemap(out, &fm, ext, NEXT) >= 0 && fm.size == st.size);
+  assert(close(out) == 0);
+  assert(fiemap(1, &fm, ext, NEXT) == -1);
+  assert(pipe(p) == 0);
+  assert(fiemap(p[0], &fm, ext, NEXT) == -1);
+  assert(close(p[0]) == 0 && close(p[1]) == 0);
+
+  assert(fiemap(fd, &fm, ext, -1) == -1);
+  assert(fiemap(fd, (struct fiemap *)0x7777beef, ext, NEXT) == -1);
+  assert(close(fd) == 0);
+  pass("");
+}
+
+int main(int argc, char *argv[]) {
+  lseek_test();
+  pread_pwrite_test();
+  readv_writev_test();
+  ftruncate_test();
+  fallocate_test();
+  hole_test();
+  sendfile_test();
+  clone_test();
+  clone_many_test();
+  defrag_test();
+  fiemap_test();
+  assert(unlink("fileiotest.tmp") == 0);
+  pass("file I/O tests");
+  exit();
+}
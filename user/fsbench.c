@@ -0,0 +1,223 @@
+// File system microbenchmarks. Measures creates, name lookups, small file
+// reads and unlinks on `nfiles` files (default 200), then sequential and
+// random reads and writes of a `kb` kilobyte file (default 256) at several
+// I/O sizes. The files live in the directory fsbench.d, which is removed
+// again at the end.
+//
+// Each phase prints one line of key=value pairs, so that runs before and
+// after a change to fs.c or bio.c can be compared by a script:
+//
+//   fsbench op=seqread iosize=4096 ops=64 bytes=262144 ticks=2 reads=64
+//           ops_per_sec=3200 kb_per_sec=12800 us_per_op=312
+//
+// ticks are uptime() ticks, and reads is the number of disk reads during
+// the phase (num_disk_reads from sysinfo). The rates assume TICKS_PER_SEC
+// and are -1 for a phase that ends within the tick it started in; give
+// larger arguments to time it.
+//
+// usage: fsbench [nfiles] [kb]
+
+#include <cdefs.h>
+#include <fcntl.h>
+#include <fs.h>
+#include <stat.h>
+#include <sysinfo.h>
+#include <user.h>
+
+// The timer is not calibrated (see kernel/lapic.c); this is its rate under
+// QEMU.
+#define TICKS_PER_SEC 100
+
+#define SMALL 100        // bytes in each small file, stored inline
+#define MAXIO 16384      // largest I/O size
+
+int iosizes[] = {512, 4096, MAXIO};
+
+// Page aligned, as for O_DIRECT, so results do not depend on where it lands
+char buf[MAXIO] __attribute__((aligned(4096)));
+
+uint start;    // uptime at the start of the current phase
+int reads;     // num_disk_reads at the start of the current phase
+uint seed = 1; // state of rnd
+
+static int disk_reads(void) {
+  struct sys_info info;
+
+  if (sysinfo(&info) < 0)
+    return 0;
+  return info.num_disk_reads;
+}
+
+static void begin(void) {
+  reads = disk_reads();
+  start = uptime();
+}
+
+// Print the results of the phase started by the last begin.
+static void report(char *op, int iosize, int ops, int bytes) {
+  int ticks, nreads;
+
+  ticks = uptime() - start;
+  nreads = disk_reads() - reads;
+  printf(1, "fsbench op=%s iosize=%d ops=%d bytes=%d ticks=%d reads=%d", op,
+         iosize, ops, bytes, ticks, nreads);
+  if (ticks > 0 && ops > 0)
+    printf(1, " ops_per_sec=%d kb_per_sec=%d us_per_op=%d\n",
+           ops * TICKS_PER_SEC / ticks, bytes / 1024 * TICKS_PER_SEC / ticks,
+           ticks * (1000000 / TICKS_PER_SEC) / ops);
+  else
+    printf(1, " ops_per_sec=-1 kb_per_sec=-1 us_per_op=-1\n");
+}
+
+static void fail(char *what, char *name) {
+  printf(2, "fsbench: %s %s failed\n", what, name);
+  exit();
+}
+
+// Build the name "<c><i>" for the i-th benchmark file.
+static void benchname(char *name, char c, int i) {
+  char digits[8];
+  int n = 0;
+
+  do {
+    digits[n++] = '0' + i % 10;
+    i /= 10;
+  } while (i > 0);
+
+  name[0] = c;
+  for (i = 0; i < n; i++)
+    name[1 + i] = digits[n - 1 - i];
+  name[1 + n] = '\0';
+}
+
+// Pseudo-random number in [0, n).
+static uint rnd(uint n) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+static void small_files(int nfiles) {
+  char name[DIRSIZ];
+  struct stat st;
+  int i, fd;
+
+  begin();
+  for (i = 0; i < nfiles; i++) {
+    benchname(name, 'f', i);
+    if ((fd = open(name, O_CREATE | O_RDWR)) < 0)
+      fail("create", name);
+    close(fd);
+  }
+  report("create", 0, nfiles, 0);
+
+  begin();
+  for (i = 0; i < nfiles; i++) {
+    benchname(name, 'f', i);
+    if ((fd = open(name, O_RDWR)) < 0 || write(fd, buf, SMALL) != SMALL)
+      fail("write", name);
+    close(fd);
+  }
+  report("smallwrite", SMALL, nfiles, nfiles * SMALL);
+
+  // Open, read and close each file, in an order unlike creation's
+  begin();
+  for (i = 0; i < nfiles; i++) {
+    benchname(name, 'f', rnd(nfiles));
+    if ((fd = open(name, O_RDONLY)) < 0 || read(fd, buf, SMALL) != SMALL)
+      fail("read", name);
+    close(fd);
+  }
+  report("smallread", SMALL, nfiles, nfiles * SMALL);
+
+  begin();
+  for (i = 0; i < nfiles; i++) {
+    benchname(name, 'f', rnd(nfiles));
+    if (stat(name, &st) < 0)
+      fail("stat", name);
+  }
+  report("lookup", 0, nfiles, 0);
+
+  begin();
+  for (i = 0; i < nfiles; i++) {
+    benchname(name, 'm', i);
+    if (stat(name, &st) == 0)
+      fail("negative lookup", name);
+  }
+  report("lookupmiss", 0, nfiles, 0);
+
+  begin();
+  for (i = 0; i < nfiles; i++) {
+    benchname(name, 'f', i);
+    if (unlink(name) < 0)
+      fail("unlink", name);
+  }
+  report("unlink", 0, nfiles, 0);
+}
+
+// Sequential and random passes over a file of n I/Os of iosize bytes.
+static void large_file(int iosize, int n) {
+  int i, fd;
+
+  unlink("big");
+  if ((fd = open("big", O_CREATE | O_RDWR)) < 0)
+    fail("create", "big");
+
+  begin();
+  for (i = 0; i < n; i++)
+    if (write(fd, buf, iosize) != iosize)
+      fail("write", "big");
+  report("seqwrite", iosize, n, n * iosize);
+
+  begin();
+  for (i = 0; i < n; i++)
+    if (pread(fd, buf, iosize, i * iosize) != iosize)
+      fail("read", "big");
+  report("seqread", iosize, n, n * iosize);
+
+  begin();
+  for (i = 0; i < n; i++)
+    if (pwrite(fd, buf, iosize, rnd(n) * iosize) != iosize)
+      fail("write", "big");
+  report("randwrite", iosize, n, n * iosize);
+
+  begin();
+  for (i = 0; i < n; i++)
+    if (pread(fd, buf, iosize, rnd(n) * iosize) != iosize)
+      fail("read", "big");
+  report("randread", iosize, n, n * iosize);
+
+  close(fd);
+  if (unlink("big") < 0)
+    fail("unlink", "big");
+}
+
+int main(int argc, char *argv[]) {
+  int nfiles, kb, i;
+
+  nfiles = 200;
+  kb = 256;
+  if (argc > 1)
+    nfiles = atoi(argv[1]);
+  if (argc > 2)
+    kb = atoi(argv[2]);
+  if (nfiles <= 0 || kb * 1024 < MAXIO) {
+    printf(2, "usage: fsbench [nfiles] [kb >= %d]\n", MAXIO / 1024);
+    exit();
+  }
+
+  for (i = 0; i < MAXIO; i++)
+    buf[i] = i;
+
+  if (mkdir("fsbench.d") < 0 || chdir("fsbench.d") < 0)
+    fail("mkdir", "fsbench.d");
+
+  printf(1, "fsbench nfiles=%d kb=%d ticks_per_sec=%d\n", nfiles, kb,
+         TICKS_PER_SEC);
+  small_files(nfiles);
+  for (i = 0; i < sizeof(iosizes) / sizeof(iosizes[0]); i++)
+    large_file(iosizes[i], kb * 1024 / iosizes[i]);
+
+  if (chdir("..") < 0 || unlink("fsbench.d") < 0)
+    fail("unlink", "fsbench.d");
+  exit();
+}
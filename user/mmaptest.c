@@ -0,0 +1,142 @@
+// Tests for mmap/munmap of regular files.
+//
+// usage: mmaptest
+
+#include <cdefs.h>
+#include <fcntl.h>
+#include <mman.h>
+#include <stat.h>
+#include <user.h>
+#include <test.h>
+
+#define FILESZ (3 * PGSIZE + 100)
+
+char buf[FILESZ];
+
+// Create mmaptest.tmp holding FILESZ bytes of a known pattern
+static void make_file(void) {
+  int fd, i;
+
+  for (i = 0; i < FILESZ; i++)
+    buf[i] = i % 251;
+  if ((fd = open("mmaptest.tmp", O_CREATE | O_RDWR)) < 0)
+    error("make_file: could not create mmaptest.tmp");
+  if (write(fd, buf, FILESZ) != FILESZ)
+    error("make_file: could not write mmaptest.tmp");
+  assert(close(fd) == 0);
+}
+
+void mmap_read(void) {
+  test("mmap_read");
+
+  int fd, i;
+  char *p;
+
+  fd = open("mmaptest.tmp", O_RDONLY);
+  if ((p = mmap(0, FILESZ, PROT_READ, MAP_PRIVATE, fd, 0)) == (char *)-1)
+    error("mmap_read: mmap failed");
+  assert(close(fd) == 0);
+
+  // The mapping outlives the file descriptor
+  for (i = 0; i < FILESZ; i++)
+    if (p[i] != (char)(i % 251))
+      error("mmap_read: byte %d is %d, expected %d", i, p[i], i % 251);
+
+  // The rest of the last page reads as zero
+  for (; i < 4 * PGSIZE; i++)
+    if (p[i] != 0)
+      error("mmap_read: byte %d past the end is %d", i, p[i]);
+
+  assert(munmap(p, FILESZ) == 0);
+  pass("");
+}
+
+void mmap_private(void) {
+  test("mmap_private");
+
+  int fd;
+  char *p;
+
+  fd = open("mmaptest.tmp", O_RDONLY);
+  if ((p = mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) ==
+      (char *)-1)
+    error("mmap_private: mmap failed");
+  p[PGSIZE] = 'x';
+  assert(p[PGSIZE] == 'x');
+  assert(munmap(p, FILESZ) == 0);
+
+  // The file is unchanged
+  assert(read(fd, buf, FILESZ) == FILESZ);
+  if (buf[PGSIZE] != (char)(PGSIZE % 251))
+    error("mmap_private: write reached the file");
+  assert(close(fd) == 0);
+  pass("");
+}
+
+void mmap_shared(void) {
+  test("mmap_shared");
+
+  int fd, pid;
+  char *p;
+
+  fd = open("mmaptest.tmp", O_RDWR);
+  if ((p = mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) ==
+      (char *)-1)
+    error("mmap_shared: mmap failed");
+
+  // A child shares the pages it inherits, and its writes reach the file
+  // when it exits
+  p[0] = 'a';
+  if ((pid = fork()) == 0) {
+    p[0] = 'b';
+    p[2 * PGSIZE + 1] = 'c';
+    exit();
+  }
+  wait();
+  if (p[0] != 'b')
+    error("mmap_shared: child write not seen by parent");
+
+  p[FILESZ - 1] = 'd';
+  assert(munmap(p, FILESZ) == 0);
+
+  assert(read(fd, buf, FILESZ) == FILESZ);
+  if (buf[0] != 'b' || buf[2 * PGSIZE + 1] != 'c' || buf[FILESZ - 1] != 'd')
+    error("mmap_shared: writes not in the file");
+  if (buf[1] != (char)1)
+    error("mmap_shared: unwritten byte changed");
+  assert(close(fd) == 0);
+  pass("");
+}
+
+void mmap_bad(void) {
+  test("mmap_bad");
+
+  int fd;
+  char *p;
+
+  fd = open("mmaptest.tmp", O_RDONLY);
+  assert(mmap(0, FILESZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) ==
+         (char *)-1);
+  assert(mmap(0, FILESZ, PROT_READ, MAP_PRIVATE, fd, 100) == (char *)-1);
+  assert(mmap(0, 0, PROT_READ, MAP_PRIVATE, fd, 0) == (char *)-1);
+  assert(mmap(0, FILESZ, PROT_READ, MAP_PRIVATE, 1, 0) == (char *)-1);
+
+  p = mmap(0, FILESZ, PROT_READ, MAP_PRIVATE, fd, 0);
+  assert(p != (char *)-1);
+  assert(munmap(p + PGSIZE, FILESZ) == -1);
+  assert(munmap(p, FILESZ) == 0);
+  assert(munmap(p, FILESZ) == -1);
+  assert(close(fd) == 0);
+  pass("");
+}
+
+int main(int argc, char *argv[]) {
+  make_file();
+  mmap_read();
+  mmap_private();
+  mmap_shared();
+  mmap_bad();
+  assert(unlink("mmaptest.tmp") == 0);
+  pass("mmap tests");
+  exit();
+}
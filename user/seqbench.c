@@ -0,0 +1,92 @@
+// Measure sequential file throughput. Writes a file of `kb` kilobytes
+// (default 128) in 8 KB chunks, reads it back through the buffer cache and
+// then with O_DIRECT, and prints how many clock ticks each pass took. Run
+// it on images built with different block sizes (make FSBSIZE=...) to
+// compare them; bsize_bench.py automates this.
+//
+// usage: seqbench [kb]
+
+#include <cdefs.h>
+#include <fcntl.h>
+#include <stat.h>
+#include <user.h>
+
+#define CHUNK 8192
+
+// Page aligned, so O_DIRECT reads can fill whole blocks in place
+char buf[CHUNK] __attribute__((aligned(4096)));
+
+// Read n chunks of seqbench.tmp opened with mode, print the time taken.
+static void readpass(char *what, int mode, int n) {
+  uint start, ticks;
+  int i, fd;
+
+  if ((fd = open("seqbench.tmp", mode)) < 0) {
+    printf(1, "seqbench: can't open seqbench.tmp\n");
+    return;
+  }
+
+  start = uptime();
+  for (i = 0; i < n; i++) {
+    if (read(fd, buf, CHUNK) != CHUNK) {
+      printf(1, "seqbench: read failed at chunk %d\n", i);
+      break;
+    }
+  }
+  ticks = uptime() - start;
+  printf(1, "seqbench: %s read %d KB in %d ticks\n", what, i * CHUNK / 1024,
+         ticks);
+  close(fd);
+}
+
+int main(int argc, char *argv[]) {
+  int kb, n, i, fd;
+  uint start, ticks;
+
+  kb = 128;
+  if (argc > 1)
+    kb = atoi(argv[1]);
+  n = kb * 1024 / CHUNK;
+
+  for (i = 0; i < CHUNK; i++)
+    buf[i] = i;
+
+  if ((fd = open("seqbench.tmp", O_CREATE | O_RDWR)) < 0) {
+    printf(1, "seqbench: can't create seqbench.tmp\n");
+    exit();
+  }
+
+  start = uptime();
+  for (i = 0; i < n; i++) {
+    if (write(fd, buf, CHUNK) != CHUNK) {
+      printf(1, "seqbench: write failed at chunk %d\n", i);
+      break;
+    }
+  }
+  n = i;
+  ticks = uptime() - start;
+  printf(1, "seqbench: wrote %d KB in %d ticks\n", n * CHUNK / 1024, ticks);
+  close(fd);
+
+  readpass("cached", O_RDONLY, n);
+  readpass("direct", O_RDONLY | O_DIRECT, n);
+
+  // The direct pass must see the same bytes
+  memset(buf, 0, CHUNK);
+  if ((fd = open("seqbench.tmp", O_RDONLY | O_DIRECT)) >= 0) {
+    if (read(fd, buf, CHUNK) != CHUNK)
+      printf(1, "seqbench: direct read failed\n");
+    for (i = 0; i < CHUNK; i++) {
+      if (buf[i] != (char)i) {
+        printf(1, "seqbench: direct read mismatch at %d\n", i);
+        break;
+      }
+    }
+    close(fd);
+  }
+
+  if (unlink("seqbench.tmp") < 0)
+    printf(1, "seqbench: unlink failed\n");
+
+  exit();
+}
@@ -63,6 +63,7 @@ void runcmd(struct cmd *cmd) {
   struct listcmd *lcmd;
   struct pipecmd *pcmd;
   struct redircmd *rcmd;
+  char path[32];
 
   if (cmd == NULL) {
     exit();
@@ -77,11 +78,15 @@ void runcmd(struct cmd *cmd) {
     if (ecmd->argv[0] == NULL) {
       exit();
     }
-    if (exec(ecmd->argv[0], ecmd->argv) < 0) {
-      printf(stderr, "failed to execute %s\n", ecmd->argv[0]);
-      exit();
+    exec(ecmd->argv[0], ecmd->argv);
+    // Programs live in the root directory, so run them from any directory
+    if (ecmd->argv[0][0] != '/' && strlen(ecmd->argv[0]) < sizeof(path) - 1) {
+      path[0] = '/';
+      strcpy(path + 1, ecmd->argv[0]);
+      exec(path, ecmd->argv);
     }
-    error("runcmd: a successful exec should not return");
+    printf(stderr, "failed to execute %s\n", ecmd->argv[0]);
+    exit();
     break;
 
   case REDIR:
@@ -165,6 +170,13 @@ int main(void) {
     if (strcmp(buf, "exit\n") == 0) {
       exit();
     }
+    if (buf[0] == 'c' && buf[1] == 'd' && buf[2] == ' ') {
+      // The shell itself must change directory, not a child
+      buf[strlen(buf) - 1] = 0;
+      if (chdir(buf + 3) < 0)
+        printf(stderr, "cannot cd %s\n", buf + 3);
+      continue;
+    }
     if ((pid = fork1()) == 0) {
       runcmd(parsecmd(buf));
     }